@@ -0,0 +1,80 @@
+
+
+#ifndef ARRAYSTORAGE_HPP
+#define ARRAYSTORAGE_HPP
+
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+// A read-only array that either owns its elements (in a std::vector) or only points at elements that live somewhere
+// else, in practice a memory mapped scene cache (see SceneCache.hpp). The code that reads the array doesn't care
+// which one it is, it always goes through the same pointer. Copying an owning array copies the elements, copying a
+// view copies the pointer; whoever made the view has to keep the memory alive.
+template<typename T>
+class ArrayStorage {
+    std::vector<T> _owned;
+    const T* _data = nullptr;
+    size_t _size = 0;
+    bool _external = false;
+public:
+    ArrayStorage() = default;
+    ArrayStorage(const ArrayStorage& other)
+        : _owned(other._owned), _data(other._external ? other._data : _owned.data()), _size(other._size), _external(other._external) {}
+    ArrayStorage(ArrayStorage&& other) noexcept
+        : _owned(std::move(other._owned)), _data(other._external ? other._data : _owned.data()), _size(other._size), _external(other._external) {
+        other.clear();
+    }
+    ArrayStorage& operator=(const ArrayStorage& other) {
+        if (this != &other) {
+            _owned = other._owned;
+            _data = other._external ? other._data : _owned.data();
+            _size = other._size;
+            _external = other._external;
+        }
+        return *this;
+    }
+    ArrayStorage& operator=(ArrayStorage&& other) noexcept {
+        if (this != &other) {
+            _owned = std::move(other._owned);
+            _data = other._external ? other._data : _owned.data();
+            _size = other._size;
+            _external = other._external;
+            other.clear();
+        }
+        return *this;
+    }
+
+    // takes over the elements
+    void assign(std::vector<T>&& elements) {
+        _owned = std::move(elements);
+        _data = _owned.data();
+        _size = _owned.size();
+        _external = false;
+    }
+    // refers to size elements at data, which someone else owns
+    void view(const T* data, size_t size) {
+        _owned = std::vector<T>();
+        _data = data;
+        _size = size;
+        _external = true;
+    }
+    void clear() {
+        _owned.clear();
+        _data = nullptr;
+        _size = 0;
+        _external = false;
+    }
+
+    const T& operator[](size_t index) const { return _data[index]; }
+    const T* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    bool isView() const { return _external; }
+    std::span<const T> span() const { return std::span<const T>(_data, _size); }
+    const T* begin() const { return _data; }
+    const T* end() const { return _data + _size; }
+};
+
+#endif //ARRAYSTORAGE_HPP
@@ -0,0 +1,209 @@
+
+
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <limits>
+
+AABB::AABB() {
+    // an "inverted" box, expanding it by anything gives exactly that thing's bounds
+    double inf = std::numeric_limits<double>::infinity();
+    _min = vec3(inf, inf, inf);
+    _max = vec3(-inf, -inf, -inf);
+}
+
+void AABB::expand(const AABB& box) {
+    for (int axis = 0; axis < 3; ++axis) {
+        _min[axis] = std::min(_min[axis], box._min[axis]);
+        _max[axis] = std::max(_max[axis], box._max[axis]);
+    }
+}
+
+void AABB::expand(const vec3& point) {
+    for (int axis = 0; axis < 3; ++axis) {
+        _min[axis] = std::min(_min[axis], point[axis]);
+        _max[axis] = std::max(_max[axis], point[axis]);
+    }
+}
+
+vec3 AABB::centroid() const {
+    return 0.5 * (_min + _max);
+}
+
+double AABB::surfaceArea() const {
+    vec3 extent = _max - _min;
+    if (extent.x() < 0 || extent.y() < 0 || extent.z() < 0) {
+        return 0.0;  // empty box
+    }
+    return 2.0 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+}
+
+bool AABB::intersects(const Ray& ray, const vec3& invDir, double tMax, double& tEntry) const {
+    // A box is the overlap of three slabs (the space between two parallel planes). We clip the ray interval
+    // [0, tMax] against each slab; if something is left at the end the ray passes through the box
+    double t0 = 0.0;
+    double t1 = tMax;
+    for (int axis = 0; axis < 3; ++axis) {
+        double tNear = (_min._elements[axis] - ray._origin._elements[axis]) * invDir._elements[axis];
+        double tFar = (_max._elements[axis] - ray._origin._elements[axis]) * invDir._elements[axis];
+        if (tNear > tFar) {
+            std::swap(tNear, tFar);
+        }
+        // written so that a NaN (ray parallel to and exactly on a slab plane) leaves the interval untouched
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar < t1 ? tFar : t1;
+        if (t0 > t1) {
+            return false;
+        }
+    }
+    tEntry = t0;
+    return true;
+}
+
+void BVH::build(const std::vector<Sphere>& spheres) {
+    clear();
+    if (spheres.empty()) {
+        return;
+    }
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;
+    std::vector<AABB> bounds;
+    std::vector<vec3> centroids;
+    bounds.reserve(spheres.size());
+    centroids.reserve(spheres.size());
+    indices.resize(spheres.size());
+    for (uint32_t i = 0; i < spheres.size(); ++i) {
+        vec3 extent(spheres[i]._radius, spheres[i]._radius, spheres[i]._radius);
+        bounds.emplace_back(spheres[i]._center - extent, spheres[i]._center + extent);
+        centroids.push_back(spheres[i]._center);
+        indices[i] = i;
+    }
+    nodes.reserve(2 * spheres.size()); // a binary tree with n leaves has at most 2n - 1 nodes
+    buildNode(nodes, indices, bounds, centroids, 0, (uint32_t) spheres.size(), 0);
+    _nodes.assign(std::move(nodes));
+    _indices.assign(std::move(indices));
+}
+
+uint32_t BVH::buildNode(std::vector<BVHNode>& nodes, std::vector<uint32_t>& indices, const std::vector<AABB>& bounds,
+                        const std::vector<vec3>& centroids, uint32_t first, uint32_t count, uint32_t depth) {
+    uint32_t nodeIndex = (uint32_t) nodes.size();
+    nodes.push_back(BVHNode{AABB(), first, count, 0});
+
+    AABB box;
+    AABB centroidBox;
+    for (uint32_t i = first; i < first + count; ++i) {
+        box.expand(bounds[indices[i]]);
+        centroidBox.expand(centroids[indices[i]]);
+    }
+    nodes[nodeIndex]._bounds = box;
+    if (count == 1) {
+        return nodeIndex;
+    }
+
+    // Surface area heuristic: the chance that a ray which hits the parent box also hits a child box is roughly
+    // area(child) / area(parent). So the expected cost of a split is
+    //      traversal + (area(left) * count(left) + area(right) * count(right)) / area(parent)
+    // in units of one sphere test, and a leaf costs count. Instead of trying every possible split we sort the
+    // centroids into a few bins per axis and only try the planes between the bins.
+    double parentArea = box.surfaceArea();
+    double bestCost = std::numeric_limits<double>::infinity();
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+    if (depth < maxSAHDepth && parentArea > 0.0) {
+        for (int axis = 0; axis < 3; ++axis) {
+            double lower = centroidBox._min[axis];
+            double extent = centroidBox._max[axis] - lower;
+            if (extent <= 0.0) {
+                continue;  // all centroids in one plane, nothing to split along this axis
+            }
+            AABB binBounds[binCount];
+            uint32_t binCounts[binCount] = {};
+            double scale = binCount / extent;
+            for (uint32_t i = first; i < first + count; ++i) {
+                uint32_t bin = std::min(binCount - 1, (uint32_t) ((centroids[indices[i]][axis] - lower) * scale));
+                binCounts[bin]++;
+                binBounds[bin].expand(bounds[indices[i]]);
+            }
+            // sweep from the right once to get the cost of everything right of each plane ...
+            double rightCost[binCount];
+            AABB rightBox;
+            uint32_t rightCount = 0;
+            for (uint32_t bin = binCount - 1; bin > 0; --bin) {
+                rightBox.expand(binBounds[bin]);
+                rightCount += binCounts[bin];
+                rightCost[bin] = rightBox.surfaceArea() * rightCount;
+            }
+            // ... and then from the left, combining both sides
+            AABB leftBox;
+            uint32_t leftCount = 0;
+            for (uint32_t split = 1; split < binCount; ++split) {
+                leftBox.expand(binBounds[split - 1]);
+                leftCount += binCounts[split - 1];
+                if (leftCount == 0 || leftCount == count) {
+                    continue;
+                }
+                double cost = 1.0 + (leftBox.surfaceArea() * leftCount + rightCost[split]) / parentArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+    }
+
+    if (count <= maxLeafSize && bestCost >= (double) count) {
+        return nodeIndex;  // testing all spheres directly is cheaper than splitting
+    }
+
+    uint32_t* begin = indices.data() + first;
+    uint32_t* end = begin + count;
+    uint32_t* middle;
+    uint32_t axis;
+    if (bestAxis >= 0) {
+        axis = (uint32_t) bestAxis;
+        double lower = centroidBox._min[axis];
+        double scale = binCount / (centroidBox._max[axis] - lower);
+        middle = std::partition(begin, end, [&](uint32_t index) {
+            return std::min(binCount - 1, (uint32_t) ((centroids[index][axis] - lower) * scale)) < bestSplit;
+        });
+    } else {
+        // no useful SAH split (too deep, or all centroids coincide): halve the range along the widest axis
+        vec3 extent = centroidBox._max - centroidBox._min;
+        axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+        middle = begin + count / 2;
+        std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+    }
+
+    uint32_t leftCount = (uint32_t) (middle - begin);
+    buildNode(nodes, indices, bounds, centroids, first, leftCount, depth + 1);
+    uint32_t right = buildNode(nodes, indices, bounds, centroids, first + leftCount, count - leftCount, depth + 1);
+    nodes[nodeIndex]._offset = right;
+    nodes[nodeIndex]._count = 0;
+    nodes[nodeIndex]._axis = axis;
+    return nodeIndex;
+}
+
+void BVH::view(std::span<const BVHNode> nodes, std::span<const uint32_t> indices) {
+    _nodes.view(nodes.data(), nodes.size());
+    _indices.view(indices.data(), indices.size());
+}
+
+void BVH::clear() {
+    _nodes.clear();
+    _indices.clear();
+}
+
+bool BVH::empty() const {
+    return _nodes.empty();
+}
+
+std::span<const BVHNode> BVH::getNodes() const {
+    return _nodes.span();
+}
+
+std::span<const uint32_t> BVH::getIndices() const {
+    return _indices.span();
+}
@@ -0,0 +1,182 @@
+
+
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ArrayStorage.hpp"
+#include "Ray.hpp"
+#include "Sphere.hpp"
+#include "Vector3.hpp"
+
+// Axis aligned bounding box, the simplest volume we can wrap around a group of spheres
+struct AABB {
+    vec3 _min;
+    vec3 _max;
+    AABB();
+    AABB(vec3 min, vec3 max): _min(min), _max(max) {}
+
+    void expand(const AABB& box);
+    void expand(const vec3& point);
+    vec3 centroid() const;
+    double surfaceArea() const;
+    // slab test. invDir is 1/direction per axis, tEntry is where the ray enters the box (0 if it starts inside)
+    bool intersects(const Ray& ray, const vec3& invDir, double tMax, double& tEntry) const;
+};
+
+struct BVHNode {
+    AABB _bounds;
+    uint32_t _offset; // leaf: first entry in BVH::_indices, inner node: index of the second child (the first one follows directly)
+    uint32_t _count;  // number of spheres in a leaf, 0 for inner nodes
+    uint32_t _axis;   // the axis an inner node was split along, used to visit the nearer child first
+
+    bool isLeaf() const { return _count > 0; }
+};
+
+// Bounding volume hierarchy over the spheres of a scene. Instead of testing a ray against every sphere we test it
+// against a tree of boxes and only look at the spheres in the leaves whose boxes the ray actually passes through.
+// The tree is built with the surface area heuristic (SAH) evaluated on a fixed number of bins per axis.
+class BVH {
+    ArrayStorage<BVHNode> _nodes;
+    ArrayStorage<uint32_t> _indices; // sphere indices, ordered so that every leaf covers a contiguous range
+
+    static uint32_t buildNode(std::vector<BVHNode>& nodes, std::vector<uint32_t>& indices, const std::vector<AABB>& bounds,
+                              const std::vector<vec3>& centroids, uint32_t first, uint32_t count, uint32_t depth);
+public:
+    static constexpr uint32_t binCount = 16;
+    static constexpr uint32_t maxLeafSize = 8;
+    static constexpr uint32_t maxSAHDepth = 64;     // below that we only split at the median, which bounds the depth
+    static constexpr uint32_t stackCapacity = 128;  // enough for maxSAHDepth + 32 median levels
+
+    void build(const std::vector<Sphere>& spheres);
+    // uses a tree that was built before and lives elsewhere (a mapped scene cache) instead of building one
+    void view(std::span<const BVHNode> nodes, std::span<const uint32_t> indices);
+    void clear();
+    bool empty() const;
+    std::span<const BVHNode> getNodes() const;
+    std::span<const uint32_t> getIndices() const;
+
+    // Walks the tree front to back. leaf(first, count) is called for every leaf the ray reaches before tMax, where
+    // [first, first + count) is a range in getIndices(). The callback may lower tMax when it finds a closer hit,
+    // and returns true to stop the traversal altogether.
+    template<typename LeafFunction>
+    void traverse(const Ray& ray, double& tMax, LeafFunction&& leaf) const {
+        if (_nodes.empty()) {
+            return;
+        }
+        const double* direction = ray._direction._elements;
+        vec3 invDir(1.0 / direction[0], 1.0 / direction[1], 1.0 / direction[2]);
+        // Nodes still to visit, with the distance at which the ray enters them. That distance doesn't change while
+        // tMax shrinks, so a node that's behind the closest hit by the time it comes off the stack is dropped
+        // without testing its box again
+        struct Pending {
+            uint32_t _node;
+            double _tEntry;
+        };
+        Pending stack[stackCapacity];
+        uint32_t stackSize = 0;
+        uint32_t current = 0;
+        double tEntry;
+        if (!_nodes[0]._bounds.intersects(ray, invDir, tMax, tEntry)) {
+            return;
+        }
+        while (true) {
+            const BVHNode& node = _nodes[current];
+            if (node.isLeaf()) {
+                if (leaf(node._offset, node._count)) {
+                    return;
+                }
+            } else {
+                // The child the ray enters first is visited first, that way tMax shrinks early and the other one
+                // may not be needed at all. Where both are entered at the same distance (the ray starts inside
+                // both, say) the split axis decides
+                uint32_t first = current + 1;
+                uint32_t second = node._offset;
+                if (direction[node._axis] < 0) {
+                    std::swap(first, second);
+                }
+                double tFirst, tSecond;
+                bool hitFirst = _nodes[first]._bounds.intersects(ray, invDir, tMax, tFirst);
+                bool hitSecond = _nodes[second]._bounds.intersects(ray, invDir, tMax, tSecond);
+                if (hitFirst && hitSecond) {
+                    if (tSecond < tFirst) {
+                        std::swap(first, second);
+                        std::swap(tFirst, tSecond);
+                    }
+                    stack[stackSize++] = Pending{second, tSecond};
+                    current = first;
+                    continue;
+                }
+                if (hitFirst || hitSecond) {
+                    current = hitFirst ? first : second;
+                    continue;
+                }
+            }
+            // pop until we find a node that is still in front of the closest hit
+            bool found = false;
+            while (stackSize > 0) {
+                Pending next = stack[--stackSize];
+                if (next._tEntry <= tMax) {
+                    current = next._node;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                return;
+            }
+        }
+    }
+
+    // The same walk for a whole packet of rays (see RayPacket). A node is visited if any ray of the packet enters
+    // it in front of its own closest hit; leaf(first, count) then tests all rays of the packet at once.
+    template<typename Packet, typename LeafFunction>
+    void traversePacket(const Packet& packet, LeafFunction&& leaf) const {
+        if (_nodes.empty() || !packet.entersBox(_nodes[0]._bounds)) {
+            return;
+        }
+        uint32_t stack[stackCapacity];
+        uint32_t stackSize = 0;
+        uint32_t current = 0;
+        while (true) {
+            const BVHNode& node = _nodes[current];
+            if (node.isLeaf()) {
+                leaf(node._offset, node._count);
+            } else {
+                uint32_t first = current + 1;
+                uint32_t second = node._offset;
+                if (packet.isNegative(node._axis)) {
+                    std::swap(first, second);
+                }
+                bool hitFirst = packet.entersBox(_nodes[first]._bounds);
+                bool hitSecond = packet.entersBox(_nodes[second]._bounds);
+                if (hitFirst && hitSecond) {
+                    stack[stackSize++] = second;
+                    current = first;
+                    continue;
+                }
+                if (hitFirst || hitSecond) {
+                    current = hitFirst ? first : second;
+                    continue;
+                }
+            }
+            bool found = false;
+            while (stackSize > 0) {
+                current = stack[--stackSize];
+                if (packet.entersBox(_nodes[current]._bounds)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                return;
+            }
+        }
+    }
+};
+
+#endif //BVH_HPP
@@ -0,0 +1,868 @@
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Camera.hpp"
+#include "Light.hpp"
+#include "Material.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "Scene.hpp"
+#include "Screen.hpp"
+#include "Sphere.hpp"
+#include "SphereKernels.hpp"
+#include "SpherePack.hpp"
+#include "Vector3.hpp"
+#include "Vector3x.hpp"
+#include "YourRayTracer.hpp"
+
+// The benchmark suite. Renders a fixed set of scenes a number of times and reports, per scene, how long each phase
+// took (setup = building the scene and its BVH, trace = rendering, encode = PNG encoding) as min/median/p90/max over
+// the repetitions, and how many primary, secondary and shadow rays per second were traced. All scenes are generated
+// from fixed seeds, so two runs of the same binary always do exactly the same work and can be compared.
+//
+//   benchmark [--scenes demo,random-1k,...] [--reps N] [--size WIDTHxHEIGHT] [--threads N] [--png PROFILE]
+//             [--format PIXELFORMAT] [--precision double|float] [--json FILE|-] [--micro] [--compare-precision]
+//             [--kernels NAME] [--verify-kernels]
+//
+// --png picks the PNG encode profile (store, fast, default or max) for the encode phase; the size of the file is
+// reported as well. --format is the pixel format of the Screen (rgb64f, rgb32f, rgba16f or rgba8). --precision
+// picks the precision of the intersection tests (see Scene::build). --json writes the results as JSON (to stdout
+// for "-") for tracking regressions over time. --micro runs the intersection micro benchmarks instead (linear scan
+// vs SIMD vs BVH, single rays vs packets, vec3 vs vec3x8). --compare-precision renders every scene in double and in float and
+// checks that the two images agree within a tolerance; the exit code is 1 if one of them doesn't.
+// --kernels picks the sphere kernels (scalar, sse2, sse4.2, avx2, avx512, see SphereKernels.hpp) instead of the widest
+// one the CPU supports. --verify-kernels checks every kernel variant the CPU supports against the scalar code and
+// Ray::intersects, with exit code 1 if one of them differs.
+
+namespace {
+
+    // ---------------------------------------------------------------- scenes
+
+    Camera demoCamera() {
+        Camera camera;
+        camera.setEyePoint(vec3(0.0,1.0,-5.0));
+        camera.setLookAt(vec3(0.0,0.0,0.0));
+        return camera;
+    }
+
+    // the seven spheres of main.cpp
+    Scene demoScene() {
+        Scene scene;
+        MaterialIndex glass = scene.addMaterial(Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.2, 1.52));
+        MaterialIndex mirror = scene.addMaterial(Material(vec3(1.0, 1.0, 1.0), vec3(1,1,1), vec3(1, 1, 1), 8, 0.1));
+        MaterialIndex red = scene.addMaterial(Material(vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 1, 1), 8, 0.8));
+        MaterialIndex cyan = scene.addMaterial(Material(vec3(0, 1, 1), vec3(0, 1, 1), vec3(1, 1, 1), 8, 0.8));
+        MaterialIndex yellow = scene.addMaterial(Material(vec3(1, 1, 0), vec3(1, 1, 0), vec3(1, 1, 1), 8, 0.8));
+        MaterialIndex green = scene.addMaterial(Material(vec3(0, 1, 0), vec3(0, 1, 0), vec3(1, 1, 1), 8, 0.8));
+        MaterialIndex white = scene.addMaterial(Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.8));
+        scene.addSphere(Sphere(0.5, vec3{2,-1,2.5}, white));
+        scene.addSphere(Sphere(1.0, vec3{-5, -1, 6.2}, red));
+        scene.addSphere(Sphere(1.0, vec3{7, -1, 8}, cyan));
+        scene.addSphere(Sphere(1.0, vec3{-12.9, -1, 25.2}, yellow));
+        scene.addSphere(Sphere(1.0, vec3{2.9, -1, 15.2}, green));
+        scene.addSphere(Sphere(2, vec3{-1,-1,2.5}, glass));
+        scene.addSphere(Sphere(2, vec3{5,-1,10.5}, mirror));
+        scene.addLight(Light::Directional(vec3(0.0,-1.0,0.0), vec3(1.0,1.0,1.0)));
+        return scene;
+    }
+
+    // count random spheres in a slab in front of the demo camera: mostly diffuse, some mirrors, a little glass.
+    // The radius shrinks with the count so that the slab is always about equally crowded
+    Scene randomScene(uint32_t count) {
+        std::mt19937 rng(count);
+        std::uniform_real_distribution<double> x(-20.0, 20.0), y(-5.0, 5.0), z(2.0, 60.0), pick(0.0, 1.0);
+        double radius = 0.3 * std::cbrt(40.0 * 10.0 * 58.0 / count);
+        Scene scene;
+        MaterialIndex diffuse[] = {
+                scene.addMaterial(Material(vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 1, 1), 8, 0.8)),
+                scene.addMaterial(Material(vec3(0, 1, 1), vec3(0, 1, 1), vec3(1, 1, 1), 8, 0.8)),
+                scene.addMaterial(Material(vec3(1, 1, 0), vec3(1, 1, 0), vec3(1, 1, 1), 8, 0.8)),
+                scene.addMaterial(Material(vec3(0, 1, 0), vec3(0, 1, 0), vec3(1, 1, 1), 8, 0.8))};
+        MaterialIndex mirror = scene.addMaterial(Material(vec3(1.0, 1.0, 1.0), vec3(1,1,1), vec3(1, 1, 1), 8, 0.1));
+        MaterialIndex glass = scene.addMaterial(Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.2, 1.52));
+        scene.spheres.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            double p = pick(rng);
+            MaterialIndex material = p < 0.05 ? glass : p < 0.2 ? mirror : diffuse[i % 4];
+            scene.addSphere(Sphere(radius, vec3(x(rng), y(rng), z(rng)), material));
+        }
+        scene.addLight(Light::Directional(vec3(0.0,-1.0,0.0), vec3(1.0,1.0,1.0)));
+        return scene;
+    }
+
+    // Worst case for the reflection/refraction part: rows of glass spheres nested inside each other, every ray
+    // that hits them gets split again and again
+    Scene deepGlassScene() {
+        Scene scene(vec3(0.2, 0.3, 0.5));
+        MaterialIndex glass = scene.addMaterial(Material(vec3(0.1, 0.1, 0.1), vec3(0.2, 0.2, 0.2), vec3(1, 1, 1), 8, 0.05, 1.52));
+        MaterialIndex thinGlass = scene.addMaterial(Material(vec3(0.1, 0.1, 0.1), vec3(0.2, 0.2, 0.2), vec3(1, 1, 1), 8, 0.05, 1.1));
+        for (int row = 0; row < 3; ++row) {
+            for (int column = -3; column <= 3; ++column) {
+                vec3 center(column * 2.2, -1.0 + row * 0.5, 2.5 + row * 3.0);
+                for (int shell = 0; shell < 4; ++shell) {
+                    scene.addSphere(Sphere(1.0 - shell * 0.22, center, shell % 2 == 0 ? glass : thinGlass));
+                }
+            }
+        }
+        scene.addLight(Light::Point(vec3(0.0, 8.0, -2.0), vec3(1.0, 1.0, 1.0)));
+        return scene;
+    }
+
+    struct BenchmarkScene {
+        std::string _name;
+        std::function<Scene()> _make;
+        int _recDepth;
+    };
+
+    std::vector<BenchmarkScene> allScenes() {
+        return {
+                {"demo", demoScene, 9},
+                {"random-1k", [] { return randomScene(1000); }, 9},
+                {"random-100k", [] { return randomScene(100000); }, 9},
+                {"random-1m", [] { return randomScene(1000000); }, 9},
+                {"deep-glass", deepGlassScene, 32},
+        };
+    }
+
+    // ---------------------------------------------------------------- measuring
+
+    using Clock = std::chrono::steady_clock;
+
+    double secondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct Repetition {
+        double _setup;
+        double _trace;
+        double _encode;
+        uint64_t _pngBytes;
+        RayCounters _rays;
+        uint32_t _spheres;
+    };
+
+    struct Output {
+        PNGProfile _profile;
+        PixelFormat _format;
+        bool _float; // trace with the float intersection tests
+    };
+
+    Repetition runOnce(const BenchmarkScene& benchmarkScene, uint64_t width, uint64_t height, unsigned threads, Output output) {
+        Repetition repetition{};
+
+        auto start = Clock::now();
+        std::shared_ptr<Scene> scene = std::make_shared<Scene>(benchmarkScene._make());
+        scene->build(); // the BVH
+        if (output._float) {
+            scene->build<float>(); // the float pack is part of the setup too
+        }
+        YourRayTracer renderer(benchmarkScene._recDepth);
+        Camera camera = demoCamera();
+        renderer.setCamera(camera);
+        renderer.setScene(scene);
+        renderer.setTileScheduler(TileScheduler(32, 32, threads));
+        Screen screen(width, height, output._format);
+        repetition._setup = secondsSince(start);
+        repetition._spheres = (uint32_t) scene->spheres.size();
+
+        start = Clock::now();
+        if (output._float) {
+            renderer.render<float>(screen);
+        } else {
+            renderer.render(screen);
+        }
+        repetition._trace = secondsSince(start);
+        repetition._rays = renderer.getRayCounters();
+
+        std::vector<unsigned char> png;
+        PNGEncodeStats encode = screen.encodePNG(png, output._profile, threads);
+        repetition._encode = encode._seconds;
+        repetition._pngBytes = encode._bytes;
+        return repetition;
+    }
+
+    struct Percentiles {
+        double _min, _p50, _p90, _max;
+    };
+
+    // nearest-rank percentiles
+    Percentiles percentiles(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        auto rank = [&](double p) { return values[std::min(values.size() - 1, (size_t) std::ceil(p * values.size()) - (p > 0 ? 1 : 0))]; };
+        return Percentiles{values.front(), rank(0.5), rank(0.9), values.back()};
+    }
+
+    struct SceneResult {
+        std::string _name;
+        uint32_t _spheres;
+        int _recDepth;
+        Percentiles _setup, _trace, _encode;
+        uint64_t _pngBytes;
+        RayCounters _rays; // per repetition, they're the same every time
+    };
+
+    SceneResult runScene(const BenchmarkScene& scene, uint64_t width, uint64_t height, unsigned threads, Output output, int repetitions) {
+        std::vector<double> setup, trace, encode;
+        Repetition last{};
+        for (int i = 0; i < repetitions; ++i) {
+            last = runOnce(scene, width, height, threads, output);
+            setup.push_back(last._setup);
+            trace.push_back(last._trace);
+            encode.push_back(last._encode);
+        }
+        return SceneResult{scene._name, last._spheres, scene._recDepth, percentiles(setup), percentiles(trace), percentiles(encode), last._pngBytes, last._rays};
+    }
+
+    // ---------------------------------------------------------------- reporting
+
+    void printTable(const std::vector<SceneResult>& results) {
+        std::cout << "sphere kernels: " << activeKernels()._name << std::endl;
+        std::cout << std::left << std::setw(13) << "scene" << std::right << std::setw(9) << "spheres"
+                  << std::setw(11) << "setup p50" << std::setw(11) << "trace min" << std::setw(11) << "trace p50"
+                  << std::setw(11) << "trace p90" << std::setw(12) << "encode p50" << std::setw(11) << "png bytes" << std::setw(13) << "primary/s"
+                  << std::setw(13) << "secondary/s" << std::setw(13) << "shadow/s" << std::endl;
+        for (const SceneResult& r : results) {
+            double trace = r._trace._p50;
+            std::cout << std::left << std::setw(13) << r._name << std::right << std::setw(9) << r._spheres
+                      << std::fixed << std::setprecision(4)
+                      << std::setw(11) << r._setup._p50 << std::setw(11) << r._trace._min << std::setw(11) << trace
+                      << std::setw(11) << r._trace._p90 << std::setw(12) << r._encode._p50 << std::setw(11) << r._pngBytes << std::setprecision(0)
+                      << std::setw(13) << r._rays._primary / trace << std::setw(13) << r._rays._secondary / trace
+                      << std::setw(13) << r._rays._shadow / trace << std::endl;
+        }
+    }
+
+    void writePercentiles(std::ostream& out, const char* name, const Percentiles& p) {
+        out << "\"" << name << "\": {\"min\": " << p._min << ", \"p50\": " << p._p50 << ", \"p90\": " << p._p90
+            << ", \"max\": " << p._max << "}";
+    }
+
+    void writeJSON(std::ostream& out, const std::vector<SceneResult>& results, uint64_t width, uint64_t height, unsigned threads, Output output, int repetitions) {
+        out << std::setprecision(9) << "{\n  \"width\": " << width << ",\n  \"height\": " << height
+            << ",\n  \"threads\": " << threads << ",\n  \"png_profile\": \"" << toString(output._profile)
+            << "\",\n  \"pixel_format\": \"" << toString(output._format) << "\",\n  \"precision\": \""
+            << (output._float ? "float" : "double") << "\",\n  \"kernels\": \"" << activeKernels()._name
+            << "\",\n  \"repetitions\": " << repetitions << ",\n  \"scenes\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const SceneResult& r = results[i];
+            double trace = r._trace._p50;
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r._name << "\", \"spheres\": " << r._spheres
+                << ", \"recursion_depth\": " << r._recDepth << ",\n     ";
+            writePercentiles(out, "setup_seconds", r._setup);
+            out << ",\n     ";
+            writePercentiles(out, "trace_seconds", r._trace);
+            out << ",\n     ";
+            writePercentiles(out, "encode_seconds", r._encode);
+            out << ",\n     \"png_bytes\": " << r._pngBytes << ", \"primary_rays\": " << r._rays._primary << ", \"secondary_rays\": " << r._rays._secondary
+                << ", \"shadow_rays\": " << r._rays._shadow
+                << ",\n     \"primary_rays_per_second\": " << r._rays._primary / trace
+                << ", \"secondary_rays_per_second\": " << r._rays._secondary / trace
+                << ", \"shadow_rays_per_second\": " << r._rays._shadow / trace << "}";
+        }
+        out << "\n  ]\n}" << std::endl;
+    }
+
+    // ---------------------------------------------------------------- micro benchmarks
+
+    Scene crowdedCube(uint32_t count, std::mt19937& rng) {
+        // spheres inside a 20x20x20 cube. The radius shrinks with the count, so that the scene stays about equally
+        // crowded and the rays hit something at a similar depth no matter how many spheres there are
+        std::uniform_real_distribution<double> position(-10.0, 10.0);
+        double radius = 4.0 / std::cbrt((double) count);
+        Scene scene;
+        MaterialIndex material = scene.addMaterial(Material(vec3(0.5, 0.5, 0.5), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8));
+        for (uint32_t i = 0; i < count; ++i) {
+            scene.addSphere(Sphere(radius, vec3(position(rng), position(rng), position(rng)), material));
+        }
+        return scene;
+    }
+
+    std::vector<Ray> randomRays(uint32_t count, std::mt19937& rng) {
+        // all rays start at a camera in front of the cube and point at a random spot inside it
+        std::uniform_real_distribution<double> target(-10.0, 10.0);
+        vec3 eye(0.0, 0.0, -30.0);
+        std::vector<Ray> rays;
+        rays.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            rays.emplace_back(eye, unit_vector(vec3(target(rng), target(rng), target(rng)) - eye));
+        }
+        return rays;
+    }
+
+    // rays per second, plus the number of hits so the compiler can't throw the work away
+    template<typename Intersect>
+    double raysPerSecond(const std::vector<Ray>& rays, Intersect&& intersect, uint64_t& hits) {
+        auto start = Clock::now();
+        for (const Ray& ray : rays) {
+            if (intersect(ray)) {
+                hits++;
+            }
+        }
+        return rays.size() / secondsSince(start);
+    }
+
+    // Shoots the same set of random rays into scenes with more and more random spheres, once with the linear scan,
+    // once with the SIMD test over all packed spheres and once through the BVH. The linear scans win for tiny scenes
+    // (no boxes to test), the BVH wins as soon as the scene is large enough; the table shows where that happens.
+    bool crossover() {
+        std::mt19937 rng(42);
+        std::vector<Ray> rays = randomRays(20000, rng);
+
+        std::cout << std::setw(10) << "spheres" << std::setw(16) << "linear rays/s" << std::setw(16) << "simd rays/s"
+                  << std::setw(16) << "bvh rays/s" << std::setw(10) << "speedup" << std::endl;
+
+        uint32_t crossover = 0;
+        for (uint32_t count = 1; count <= 16384; count *= 2) {
+            Scene scene = crowdedCube(count, rng);
+            scene.build();
+            uint64_t linearHits = 0, simdHits = 0, bvhHits = 0;
+            double linear = raysPerSecond(rays, [&](const Ray& r) { return scene.intersectLinear(r).has_value(); }, linearHits);
+            double simd = raysPerSecond(rays, [&](const Ray& r) {
+                Hit best{0.0, SpherePack::noHit};
+                scene.pack.intersect(r, 0, scene.pack.size(), best);
+                return best._index != SpherePack::noHit;
+            }, simdHits);
+            double bvh = raysPerSecond(rays, [&](const Ray& r) { return scene.intersect(r).has_value(); }, bvhHits);
+            if (linearHits != bvhHits || linearHits != simdHits) {
+                std::cerr << "BVH, SIMD and linear scan disagree for " << count << " spheres" << std::endl;
+                return false;
+            }
+            if (crossover == 0 && bvh > linear) {
+                crossover = count;
+            }
+            std::cout << std::setw(10) << count << std::setw(16) << std::fixed << std::setprecision(0) << linear
+                      << std::setw(16) << simd << std::setw(16) << bvh << std::setw(10) << std::setprecision(2) << bvh / linear << std::endl;
+        }
+        std::cout << "BVH is faster from " << crossover << " spheres on" << std::endl;
+        return true;
+    }
+
+    // Primary rays of main.cpp's camera, once intersected one by one and once in 4x4 packets
+    bool primaryRays() {
+        Scene scene = demoScene();
+        scene.build();
+        Camera camera = demoCamera();
+        YourRayTracer tracer(1);
+        tracer.setCamera(camera);
+        Screen screen(1280, 800);
+        RaySetup rs = tracer.computeRaySetup(screen);
+        uint64_t pixels = screen.getWidth() * screen.getHeight();
+
+        uint64_t scalarHits = 0;
+        auto start = Clock::now();
+        for (uint64_t y = 0; y < screen.getHeight(); ++y) {
+            for (uint64_t x = 0; x < screen.getWidth(); ++x) {
+                scalarHits += scene.intersect(tracer.computeRay(x, y, rs)).has_value();
+            }
+        }
+        double scalar = secondsSince(start);
+
+        // with the eye relative spheres (computed inside the timing, as render() does once per frame) and without
+        auto tracePackets = [&](bool precomputed, uint64_t& hits) {
+            auto packetStart = Clock::now();
+            std::vector<EyeRelativeSphere<double>> eye;
+            if (precomputed) {
+                scene.pack.eyeRelative(rs._rayOrigin, eye);
+            }
+            for (uint64_t y0 = 0; y0 < screen.getHeight(); y0 += RayPacket::height) {
+                for (uint64_t x0 = 0; x0 < screen.getWidth(); x0 += RayPacket::width) {
+                    RayPacket packet = tracer.computeRayPacket(x0, y0, screen.getWidth(), screen.getHeight(), rs);
+                    scene.intersect(packet, std::span<const EyeRelativeSphere<double>>(eye));
+                    for (const Hit& hit : packet._hits) {
+                        hits += hit._index != SpherePack::noHit;
+                    }
+                }
+            }
+            return secondsSince(packetStart);
+        };
+        uint64_t packetHits = 0, eyeHits = 0;
+        double packets = tracePackets(false, packetHits);
+        double eyePackets = tracePackets(true, eyeHits);
+
+        if (scalarHits != packetHits || scalarHits != eyeHits) {
+            std::cerr << "packets and single rays disagree on the demo scene" << std::endl;
+            return false;
+        }
+        // the packets' directions (vec3x, see Vector3x.hpp) have to be exactly those of the single rays
+        for (uint64_t y0 = 0; y0 < screen.getHeight(); y0 += RayPacket::height) {
+            for (uint64_t x0 = 0; x0 < screen.getWidth(); x0 += RayPacket::width) {
+                RayPacket packet = tracer.computeRayPacket(x0, y0, screen.getWidth(), screen.getHeight(), rs);
+                for (uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                    vec3 direction = tracer.computeRay(x0 + lane % RayPacket::width, y0 + lane / RayPacket::width, rs)._direction;
+                    if (packet._directionX[lane] != direction.x() || packet._directionY[lane] != direction.y() || packet._directionZ[lane] != direction.z()
+                            || packet._inverseX[lane] != 1.0 / direction.x()) {
+                        std::cerr << "packet and single ray directions differ at " << x0 << ", " << y0 << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+        std::cout << std::fixed << std::setprecision(0) << "demo scene primary rays/s: single " << pixels / scalar
+                  << ", 4x4 packets " << pixels / packets << ", packets from the eye relative spheres "
+                  << pixels / eyePackets << std::setprecision(2) << " (" << scalar / packets << "x, "
+                  << scalar / eyePackets << "x)" << std::endl;
+        return true;
+    }
+
+    // vec3x8 (Vector3x.hpp) against vec3: every function has to give, lane by lane, bit for bit what the vec3 one
+    // gives. Then normalizing and reflecting a lot of directions is timed both ways
+    bool batchVectors() {
+        constexpr uint32_t count = 1 << 16;
+        std::mt19937 rng(25);
+        std::uniform_real_distribution<double> value(-2.0, 2.0), ratio(0.5, 2.0);
+        std::vector<double> coordinates[6];
+        std::vector<double> ratios(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            for (std::vector<double>& c : coordinates) {
+                c.push_back(value(rng));
+            }
+            ratios[i] = ratio(rng);
+        }
+        auto same = [](const vec3& a, const vec3& b) { return a.x() == b.x() && a.y() == b.y() && a.z() == b.z(); };
+        for (uint32_t i = 0; i < count; i += 8) {
+            vec3x8 u = vec3x8::load(&coordinates[0][i], &coordinates[1][i], &coordinates[2][i]);
+            vec3x8 v = vec3x8::load(&coordinates[3][i], &coordinates[4][i], &coordinates[5][i]);
+            vec3x8 direction = unit_vector(u);
+            vec3x8 normal = unit_vector(v);
+            doublex8 dots = dot(u, v);
+            vec3x8 crossed = cross(u, v);
+            vec3x8 reflected = direction.reflection(normal);
+            uint32_t refracted;
+            vec3x8 refraction = direction.refraction(normal, doublex8::load(&ratios[i]), refracted);
+            for (uint32_t lane = 0; lane < 8; ++lane) {
+                vec3 a = u.get(lane), b = v.get(lane);
+                std::optional<vec3> expected = unit_vector(a).refraction(unit_vector(b), ratios[i + lane]);
+                bool refracts = (refracted >> lane) & 1u;
+                if (dots[lane] != dot(a, b) || !same(crossed.get(lane), cross(a, b)) || !same(direction.get(lane), unit_vector(a))
+                        || !same(reflected.get(lane), unit_vector(a).reflection(unit_vector(b)))
+                        || refracts != expected.has_value() || (refracts && !same(refraction.get(lane), *expected))) {
+                    std::cerr << "vec3x8 and vec3 disagree for vector " << i + lane << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        std::vector<double> out[3];
+        for (std::vector<double>& o : out) {
+            o.resize(count);
+        }
+        auto scalarStart = Clock::now();
+        for (uint32_t i = 0; i < count; ++i) {
+            vec3 r = unit_vector(vec3(coordinates[0][i], coordinates[1][i], coordinates[2][i]))
+                    .reflection(unit_vector(vec3(coordinates[3][i], coordinates[4][i], coordinates[5][i])));
+            out[0][i] = r.x();
+            out[1][i] = r.y();
+            out[2][i] = r.z();
+        }
+        double scalar = secondsSince(scalarStart);
+        auto batchStart = Clock::now();
+        for (uint32_t i = 0; i < count; i += 8) {
+            vec3x8 r = unit_vector(vec3x8::load(&coordinates[0][i], &coordinates[1][i], &coordinates[2][i]))
+                    .reflection(unit_vector(vec3x8::load(&coordinates[3][i], &coordinates[4][i], &coordinates[5][i])));
+            r.store(allLanes<8>(), &out[0][i], &out[1][i], &out[2][i]);
+        }
+        double batch = secondsSince(batchStart);
+        std::cout << std::fixed << std::setprecision(0) << "normalize and reflect, vectors/s: vec3 " << count / scalar
+                  << ", vec3x8 " << count / batch << std::setprecision(2) << " (" << scalar / batch << "x)" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        return true;
+    }
+
+    // ---------------------------------------------------------------- kernel variants
+
+    // What the kernel checks compare: the closest hit among the packed spheres [first, first + count) but skip, and
+    // whether a shadow ray up to tMax is blocked, for a ray and for a 4x4 packet
+    struct KernelResults {
+        std::vector<Hit> _hits;
+        std::vector<bool> _occluded;
+        std::vector<Hit> _packetHits;
+    };
+
+    struct KernelCase {
+        Ray _ray;
+        uint32_t _first, _count, _skip;
+        double _tMax;
+    };
+
+    // spheres in the 20x20x20 cube of crowdedCube, every third one glass (which doesn't cast shadows), and rays
+    // from outside the cube as well as from inside (often inside a sphere, where the far side is the hit)
+    struct KernelTestScene {
+        Scene _scene;
+        std::vector<KernelCase> _cases;
+        std::vector<RayPacket> _packets;
+    };
+
+    KernelTestScene kernelTestScene(uint32_t count, std::mt19937& rng) {
+        std::uniform_real_distribution<double> position(-10.0, 10.0), unit(-1.0, 1.0), spread(-0.05, 0.05), pick(0.0, 1.0);
+        double radius = 4.0 / std::cbrt((double) count);
+        KernelTestScene test;
+        MaterialIndex opaque = test._scene.addMaterial(Material(vec3(0.5, 0.5, 0.5), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8));
+        MaterialIndex glass = test._scene.addMaterial(Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.2, 1.52));
+        for (uint32_t i = 0; i < count; ++i) {
+            test._scene.addSphere(Sphere(radius, vec3(position(rng), position(rng), position(rng)), i % 3 == 2 ? glass : opaque));
+        }
+        test._scene.build();
+        test._scene.build<float>();
+        auto randomDirection = [&]() {
+            vec3 direction;
+            do {
+                direction = vec3(unit(rng), unit(rng), unit(rng));
+            } while (direction.length() < 0.1);
+            return unit_vector(direction);
+        };
+        std::vector<Ray> outside = randomRays(2000, rng);
+        for (uint32_t i = 0; i < 4000; ++i) {
+            Ray ray = i < outside.size() ? outside[i] : Ray(vec3(position(rng), position(rng), position(rng)), randomDirection());
+            // a random range, as a BVH leaf would give; the whole pack half of the time
+            uint32_t first = pick(rng) < 0.5 ? 0 : (uint32_t) (pick(rng) * count);
+            uint32_t rest = count - first;
+            uint32_t length = pick(rng) < 0.5 ? rest : std::min<uint32_t>(rest, 1 + (uint32_t) (pick(rng) * rest));
+            uint32_t skip = pick(rng) < 0.25 ? first + (uint32_t) (pick(rng) * length) : SpherePack::noHit;
+            test._cases.push_back(KernelCase{ray, first, length, skip, 40.0 * pick(rng)});
+        }
+        for (uint32_t i = 0; i < 200; ++i) {
+            // packets of nearby directions from one origin, some of them from the same point (as the eye would be)
+            vec3 origin = i % 2 == 0 ? vec3(0.0, 0.0, -30.0) : vec3(position(rng), position(rng), position(rng));
+            vec3 center = i % 2 == 0 ? unit_vector(vec3(position(rng), position(rng), position(rng)) - origin) : randomDirection();
+            RayPacket packet(origin);
+            for (uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                if (pick(rng) < 0.9) {
+                    packet.setRay(lane, unit_vector(center + vec3(spread(rng), spread(rng), spread(rng))));
+                }
+            }
+            test._packets.push_back(packet);
+        }
+        return test;
+    }
+
+    // everything in test, with the active kernels
+    template<typename Real>
+    KernelResults runKernels(const KernelTestScene& test) {
+        const BasicSpherePack<Real>& pack = test._scene.getPack<Real>();
+        KernelResults results;
+        for (const KernelCase& c : test._cases) {
+            Hit best{0.0, SpherePack::noHit};
+            pack.intersect(c._ray, c._first, c._count, best, c._skip);
+            results._hits.push_back(best);
+            results._occluded.push_back(pack.occludes(c._ray, c._first, c._count, c._tMax, c._skip));
+        }
+        std::vector<EyeRelativeSphere<Real>> eye;
+        for (const RayPacket& original : test._packets) {
+            for (bool precomputed : {false, true}) {
+                RayPacket packet = original;
+                if (precomputed) {
+                    pack.eyeRelative(packet._origin, eye);
+                }
+                pack.intersect(packet, 0, pack.size(), precomputed ? std::span<const EyeRelativeSphere<Real>>(eye) : std::span<const EyeRelativeSphere<Real>>());
+                for (uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                    results._packetHits.push_back(packet._hits[lane]);
+                }
+            }
+        }
+        return results;
+    }
+
+    // the same with Ray::intersects, one sphere at a time. Ties go to the lower index in Scene::spheres, as in the kernels
+    KernelResults referenceResults(const KernelTestScene& test) {
+        const Scene& scene = test._scene;
+        auto closest = [&](const Ray& ray, uint32_t first, uint32_t count, uint32_t skip) {
+            Hit best{0.0, SpherePack::noHit};
+            for (uint32_t i = first; i < first + count; ++i) {
+                std::optional<double> t = ray.intersects(scene.spheres[scene.pack.getSphereIndex(i)]);
+                if (i != skip && t.has_value() && (best._index == SpherePack::noHit || *t < best._t
+                        || (*t == best._t && scene.pack.getSphereIndex(i) < scene.pack.getSphereIndex(best._index)))) {
+                    best = Hit{*t, i};
+                }
+            }
+            return best;
+        };
+        KernelResults results;
+        for (const KernelCase& c : test._cases) {
+            results._hits.push_back(closest(c._ray, c._first, c._count, c._skip));
+            bool occluded = false;
+            for (uint32_t i = c._first; i < c._first + c._count; ++i) {
+                std::optional<double> t = c._ray.intersects(scene.spheres[scene.pack.getSphereIndex(i)]);
+                occluded = occluded || (i != c._skip && t.has_value() && *t < c._tMax && scene.pack.getMaterial(i).isShadowCaster());
+            }
+            results._occluded.push_back(occluded);
+        }
+        for (const RayPacket& packet : test._packets) {
+            for (int twice = 0; twice < 2; ++twice) {
+                for (uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                    results._packetHits.push_back(packet.isActive(lane) ? closest(packet.getRay(lane), 0, scene.pack.size(), SpherePack::noHit)
+                                                                        : Hit{0.0, SpherePack::noHit});
+                }
+            }
+        }
+        return results;
+    }
+
+    bool sameHits(const std::vector<Hit>& a, const std::vector<Hit>& b) {
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i]._index != b[i]._index || (a[i]._index != SpherePack::noHit && a[i]._t != b[i]._t)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The differential test of the kernel variants (see SphereKernels.hpp). Every variant this CPU supports has to
+    // give bit for bit what the scalar kernels give, in both precisions, and the scalar double kernels bit for bit
+    // what Ray::intersects gives. The float kernels can't match that exactly; they pass if they agree with
+    // Ray::intersects on the sphere for all but maxOtherSphere of the hits and the distances are within tTolerance
+    bool verifyKernels() {
+        constexpr double maxOtherSphere = 0.002; // of all hits; rays that graze two spheres at about the same distance
+        constexpr double tTolerance = 1e-4;      // relative
+        std::string active = activeKernels()._name;
+        std::mt19937 rng(24);
+        uint64_t compared = 0, otherSphere = 0;
+        double maxError = 0.0;
+        std::vector<std::string> failures;
+        for (uint32_t count : {1u, 2u, 3u, 7u, 8u, 9u, 15u, 16u, 17u, 33u, 100u, 1000u}) {
+            KernelTestScene test = kernelTestScene(count, rng);
+            selectKernels("scalar");
+            KernelResults scalarDouble = runKernels<double>(test);
+            KernelResults scalarFloat = runKernels<float>(test);
+            KernelResults reference = referenceResults(test);
+            if (!sameHits(scalarDouble._hits, reference._hits) || scalarDouble._occluded != reference._occluded
+                    || !sameHits(scalarDouble._packetHits, reference._packetHits)) {
+                failures.push_back("scalar double vs Ray::intersects, " + std::to_string(count) + " spheres");
+            }
+            for (const std::vector<Hit>* hits : {&scalarFloat._hits, &scalarFloat._packetHits}) {
+                const std::vector<Hit>& expected = hits == &scalarFloat._hits ? reference._hits : reference._packetHits;
+                for (size_t i = 0; i < hits->size(); ++i) {
+                    const Hit& a = (*hits)[i];
+                    const Hit& b = expected[i];
+                    if (a._index == SpherePack::noHit && b._index == SpherePack::noHit) {
+                        continue;
+                    }
+                    compared++;
+                    if (a._index != b._index) {
+                        otherSphere++;
+                    } else {
+                        maxError = std::max(maxError, std::abs(a._t - b._t) / std::max(1.0, b._t));
+                    }
+                }
+            }
+            for (const KernelSet& kernels : supportedKernels()) {
+                selectKernels(kernels._name);
+                KernelResults d = runKernels<double>(test);
+                KernelResults f = runKernels<float>(test);
+                if (!sameHits(d._hits, scalarDouble._hits) || d._occluded != scalarDouble._occluded || !sameHits(d._packetHits, scalarDouble._packetHits)) {
+                    failures.push_back(std::string(kernels._name) + " double vs scalar, " + std::to_string(count) + " spheres");
+                }
+                if (!sameHits(f._hits, scalarFloat._hits) || f._occluded != scalarFloat._occluded || !sameHits(f._packetHits, scalarFloat._packetHits)) {
+                    failures.push_back(std::string(kernels._name) + " float vs scalar, " + std::to_string(count) + " spheres");
+                }
+            }
+        }
+        selectKernels(active);
+
+        std::cout << "kernel sets:";
+        for (const KernelSet& kernels : supportedKernels()) {
+            std::cout << " " << kernels._name << (kernels._name == active ? " (active)" : "");
+        }
+        std::cout << std::endl;
+        for (const std::string& failure : failures) {
+            std::cout << "FAILED: " << failure << std::endl;
+        }
+        bool ok = failures.empty();
+        double otherFraction = compared == 0 ? 0.0 : (double) otherSphere / compared;
+        bool floatOk = otherFraction <= maxOtherSphere && maxError <= tTolerance;
+        std::cout << "all variants match the scalar kernels bit for bit, scalar double matches Ray::intersects: "
+                  << (ok ? "ok" : "FAILED") << std::endl;
+        std::cout << std::setprecision(3) << "float vs Ray::intersects: " << 100.0 * otherFraction << "% of " << compared
+                  << " hits on another sphere, max relative t error " << maxError << ": " << (floatOk ? "ok" : "FAILED") << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        return ok && floatOk;
+    }
+
+    // ---------------------------------------------------------------- float vs double
+
+    // Renders the scene once with the double and once with the float intersection tests and compares the two
+    // images in 8 bit. A float distance is less precise, so some pixels along silhouettes, where a ray only just
+    // hits or misses, and in reflections of them come out differently; everywhere else the colours only move by
+    // a rounding step. How many silhouettes there are depends a lot on the scene: in demo a few percent of the
+    // pixels are near one, in random-100k almost all of them. So this fails if more than maxDifferent of the pixels
+    // are off by more than tolerance, or if the mean difference is above maxMean, which catches a systematic error
+    // (say, self intersections or a wrong offset) that moves whole areas instead of edges
+    bool comparePrecision(const BenchmarkScene& benchmarkScene, uint64_t width, uint64_t height, unsigned threads) {
+        constexpr int tolerance = 8;              // out of 255, per channel
+        constexpr double maxDifferent = 0.05;     // of all pixels
+        constexpr double maxMean = 1.0;           // out of 255, per channel
+        std::shared_ptr<Scene> scene = std::make_shared<Scene>(benchmarkScene._make());
+        scene->build();
+        scene->build<float>();
+        YourRayTracer renderer(benchmarkScene._recDepth);
+        Camera camera = demoCamera();
+        renderer.setCamera(camera);
+        renderer.setScene(scene);
+        renderer.setTileScheduler(TileScheduler(32, 32, threads));
+        Screen reference(width, height);
+        Screen single(width, height);
+        renderer.render(reference);
+        renderer.render<float>(single);
+
+        uint64_t different = 0;
+        int maxDifference = 0;
+        double sum = 0.0;
+        for (uint64_t y = 0; y < height; ++y) {
+            for (uint64_t x = 0; x < width; ++x) {
+                color a = reference.getPixel(x, y), b = single.getPixel(x, y);
+                int pixelDifference = 0;
+                for (int c = 0; c < 3; ++c) {
+                    // the same conversion to 8 bit as the PNG writer
+                    int difference = std::abs(int(255.999 * std::clamp(a[c], 0.0, 1.0)) - int(255.999 * std::clamp(b[c], 0.0, 1.0)));
+                    pixelDifference = std::max(pixelDifference, difference);
+                    sum += difference;
+                }
+                maxDifference = std::max(maxDifference, pixelDifference);
+                different += pixelDifference > tolerance;
+            }
+        }
+        double fraction = (double) different / (width * height);
+        double mean = sum / (3.0 * width * height);
+        bool ok = fraction <= maxDifferent && mean <= maxMean;
+        std::cout << std::left << std::setw(13) << benchmarkScene._name << std::right << std::fixed << std::setprecision(4)
+                  << " mean difference " << mean << "/255, max " << maxDifference
+                  << "/255, " << std::setprecision(3) << 100.0 * fraction << "% of the pixels off by more than "
+                  << tolerance << "/255: " << (ok ? "ok" : "FAILED") << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        return ok;
+    }
+
+    // ---------------------------------------------------------------- command line
+
+    std::vector<std::string> split(const std::string& list) {
+        std::vector<std::string> parts;
+        std::stringstream stream(list);
+        std::string part;
+        while (std::getline(stream, part, ',')) {
+            parts.push_back(part);
+        }
+        return parts;
+    }
+
+    int usage() {
+        std::cerr << "usage: benchmark [--scenes demo,random-1k,random-100k,random-1m,deep-glass] [--reps N]\n"
+                     "                 [--size WIDTHxHEIGHT] [--threads N] [--png store|fast|default|max]\n"
+                     "                 [--format rgb64f|rgb32f|rgba16f|rgba8] [--precision double|float]\n"
+                     "                 [--json FILE|-] [--micro] [--compare-precision]\n"
+                     "                 [--kernels scalar|sse2|sse4.2|avx2|avx512] [--verify-kernels]" << std::endl;
+        return 2;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> sceneNames;
+    int repetitions = 5;
+    uint64_t width = 640, height = 400;
+    unsigned threads = 0; // all cores
+    std::string jsonPath;
+    Output output{PNGProfile::Default, PixelFormat::RGB64F, false};
+    bool micro = false;
+    bool compare = false;
+    bool verify = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--scenes" && hasValue) {
+            sceneNames = split(argv[++i]);
+        } else if (arg == "--reps" && hasValue) {
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--size" && hasValue) {
+            if (std::sscanf(argv[++i], "%" SCNu64 "x%" SCNu64, &width, &height) != 2 || width == 0 || height == 0) {
+                return usage();
+            }
+        } else if (arg == "--threads" && hasValue) {
+            threads = (unsigned) std::atoi(argv[++i]);
+        } else if (arg == "--png" && hasValue) {
+            if (!parsePNGProfile(argv[++i], output._profile)) {
+                return usage();
+            }
+        } else if (arg == "--format" && hasValue) {
+            if (!parsePixelFormat(argv[++i], output._format)) {
+                return usage();
+            }
+        } else if (arg == "--precision" && hasValue) {
+            std::string precision = argv[++i];
+            if (precision != "double" && precision != "float") {
+                return usage();
+            }
+            output._float = precision == "float";
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else if (arg == "--micro") {
+            micro = true;
+        } else if (arg == "--compare-precision") {
+            compare = true;
+        } else if (arg == "--kernels" && hasValue) {
+            if (!selectKernels(argv[++i])) {
+                std::cerr << "kernels " << argv[i] << " are not built in or not supported by this CPU" << std::endl;
+                return usage();
+            }
+        } else if (arg == "--verify-kernels") {
+            verify = true;
+        } else {
+            return usage();
+        }
+    }
+
+    if (verify) {
+        return verifyKernels() ? 0 : 1;
+    }
+    if (micro) {
+        return crossover() && primaryRays() && batchVectors() ? 0 : 1;
+    }
+
+    std::vector<BenchmarkScene> scenes;
+    for (const BenchmarkScene& scene : allScenes()) {
+        if (sceneNames.empty() || std::find(sceneNames.begin(), sceneNames.end(), scene._name) != sceneNames.end()) {
+            scenes.push_back(scene);
+        }
+    }
+    if (scenes.empty()) {
+        return usage();
+    }
+    threads = TileScheduler(32, 32, threads).getThreadCount();
+
+    if (compare) {
+        bool ok = true;
+        for (const BenchmarkScene& scene : scenes) {
+            ok = comparePrecision(scene, width, height, threads) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    std::vector<SceneResult> results;
+    for (const BenchmarkScene& scene : scenes) {
+        std::cerr << "running " << scene._name << " ..." << std::endl;
+        results.push_back(runScene(scene, width, height, threads, output, repetitions));
+    }
+
+    if (jsonPath == "-") {
+        writeJSON(std::cout, results, width, height, threads, output, repetitions);
+        return 0;
+    }
+    printTable(results);
+    if (!jsonPath.empty()) {
+        std::ofstream json(jsonPath);
+        writeJSON(json, results, width, height, threads, output, repetitions);
+    }
+    return 0;
+}
@@ -2,10 +2,18 @@
 
 #include "Intersection.hpp"
 
-Intersection::Intersection(Material& material, vec3 normal, double t) : _material(material), _normal(normal), _t(t) {}
+#include "Ray.hpp"
+
+Intersection::Intersection(const Material& material, vec3 normal, double t) : _material(&material), _normal(normal), _t(t), _index(UINT32_MAX) {}
+
+Intersection::Intersection(const Ray& ray, const vec3& center, const Material& material, double t, uint32_t index)
+    : _material(&material), _t(t), _index(index) {
+    vec3 intersection_point = ray.point_at(t);
+    _normal = unit_vector(intersection_point - center);  // on a sphere the normal points from the center to the surface
+}
 
 const Material& Intersection::getMaterial() const {
-    return _material;
+    return *_material;
 }
 const vec3& Intersection::getNormal() const {
     return _normal;
@@ -2,14 +2,30 @@
 
 #ifndef INTERSECTION_HPP
 #define INTERSECTION_HPP
+#include <cstdint>
 #include "Material.hpp"
 #include "Vector3.hpp"
 
+struct Ray;
+
+// What the inner intersection loops keep track of: how far along the ray and which sphere. That's all they need to
+// find the closest hit, the normal and the material are only worked out for the winner (see Intersection)
+struct Hit {
+    double _t;
+    uint32_t _index;
+};
+
+// The closest hit, ready for shading. The material is not copied, it points into the Scene the ray was traced in,
+// so an Intersection must not outlive its Scene.
 struct Intersection {
-    Material _material;
+    const Material* _material;
     vec3 _normal;
     double _t;
-    Intersection( Material& material, vec3 normal, double t);
+    // the sphere that was hit, numbered like the Hit it came from (see Scene::intersect). Rays leaving the surface
+    // hand it back to Scene::intersect, so that they don't hit the same spot again. UINT32_MAX if there's no sphere
+    uint32_t _index;
+    Intersection(const Material& material, vec3 normal, double t);
+    Intersection(const Ray& ray, const vec3& center, const Material& material, double t, uint32_t index); // computes the sphere normal
     const Material& getMaterial() const;
     const vec3& getNormal() const;
     double getT() const;
@@ -0,0 +1,31 @@
+
+
+#include "Light.hpp"
+
+#include <limits>
+
+Light Light::Point(vec3 position, vec3 color){
+    return Light(Type::Point, position, vec3(), color);
+}
+
+Light Light::Directional(vec3 direction, vec3 color){
+    return Light(Type::Directional, vec3(), unit_vector(direction), color);
+}
+
+Light::Type Light::getType() const{
+    return _type;
+}
+
+const vec3& Light::getColor() const{
+    return _color;
+}
+
+vec3 Light::getDirectionFrom(const vec3& point, double& distance) const{
+    if(_type == Type::Directional){
+        distance = std::numeric_limits<double>::infinity();
+        return -_direction; // towards the light is against the direction the light travels
+    }
+    vec3 toLight = _position - point;
+    distance = toLight.length();
+    return toLight / distance;
+}
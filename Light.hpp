@@ -0,0 +1,29 @@
+
+
+#ifndef LIGHT_HPP
+#define LIGHT_HPP
+
+#include "Vector3.hpp"
+
+// A light source. Point lights sit at a position and shine in all directions, directional lights are infinitely far
+// away (like the sun) so all their rays are parallel. Both can be blocked by objects, which gives us shadows.
+class Light {
+public:
+    enum class Type { Point, Directional };
+private:
+    Type _type;
+    vec3 _position;  // point lights only
+    vec3 _direction; // directional lights only: the direction the light travels in, normalized
+    vec3 _color;
+    Light(Type type, vec3 position, vec3 direction, vec3 color): _type(type), _position(position), _direction(direction), _color(color) {}
+public:
+    static Light Point(vec3 position, vec3 color);
+    static Light Directional(vec3 direction, vec3 color);
+
+    Type getType() const;
+    const vec3& getColor() const;
+    // unit vector from point towards the light, and how far away the light is (infinity for directional lights)
+    vec3 getDirectionFrom(const vec3& point, double& distance) const;
+};
+
+#endif //LIGHT_HPP
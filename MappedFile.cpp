@@ -0,0 +1,112 @@
+
+
+#include "MappedFile.hpp"
+
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RAYTRACE_HAS_MMAP 1
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : _address(std::exchange(other._address, nullptr)), _size(std::exchange(other._size, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        _address = std::exchange(other._address, nullptr);
+        _size = std::exchange(other._size, 0);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+std::optional<MappedFile> MappedFile::create(const char* filename, size_t size) {
+#ifdef RAYTRACE_HAS_MMAP
+    int fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return {};
+    }
+    // ftruncate makes a sparse file, the pages only take up disk space once they're written
+    if (size == 0 || ::ftruncate(fd, (off_t) size) != 0) {
+        ::close(fd);
+        return {};
+    }
+    void* address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if (address == MAP_FAILED) {
+        return {};
+    }
+    return MappedFile(address, size);
+#else
+    (void) filename;
+    (void) size;
+    return {};
+#endif
+}
+
+std::optional<MappedFile> MappedFile::open(const char* filename) {
+#ifdef RAYTRACE_HAS_MMAP
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return {};
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return {};
+    }
+    size_t size = (size_t) info.st_size;
+    // nothing is read here, the pages are only loaded from the page cache when they are first touched
+    void* address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        return {};
+    }
+    return MappedFile(address, size);
+#else
+    (void) filename;
+    return {};
+#endif
+}
+
+bool MappedFile::isOpen() const {
+    return _address != nullptr;
+}
+
+void* MappedFile::data() {
+    return _address;
+}
+
+const void* MappedFile::data() const {
+    return _address;
+}
+
+size_t MappedFile::size() const {
+    return _size;
+}
+
+bool MappedFile::flush() {
+#ifdef RAYTRACE_HAS_MMAP
+    return _address != nullptr && ::msync(_address, _size, MS_SYNC) == 0;
+#else
+    return false;
+#endif
+}
+
+void MappedFile::close() {
+#ifdef RAYTRACE_HAS_MMAP
+    if (_address != nullptr) {
+        ::munmap(_address, _size);
+    }
+#endif
+    _address = nullptr;
+    _size = 0;
+}
@@ -0,0 +1,39 @@
+
+
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <optional>
+
+// A file mapped into memory (mmap), unmapped again when the MappedFile goes away. Reads and writes go straight to the
+// page cache: nothing is copied in or out, the file can be bigger than the RAM, and other processes that map the same
+// file see the same bytes. Only available on POSIX systems, everywhere else the factories return nothing.
+class MappedFile {
+    void* _address = nullptr;
+    size_t _size = 0;
+
+    MappedFile(void* address, size_t size): _address(address), _size(size) {}
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    ~MappedFile();
+
+    // creates (or truncates) the file, makes it size bytes long (zeros) and maps it for reading and writing
+    static std::optional<MappedFile> create(const char* filename, size_t size);
+    // maps an existing file for reading only. Writing to the mapping crashes, so only use the const data()
+    static std::optional<MappedFile> open(const char* filename);
+
+    bool isOpen() const;
+    void* data();
+    const void* data() const;
+    size_t size() const;
+    // writes the changed pages back to the file now instead of whenever the kernel gets around to it
+    bool flush();
+    void close();
+};
+
+#endif //MAPPEDFILE_HPP
@@ -8,6 +8,11 @@ double Material::getExponent() const{
     return _exponent;
 }
 
+// Transparent materials let (most of) the light through, so only opaque ones block shadow rays
+bool Material::isShadowCaster() const{
+    return !refracts();
+}
+
 bool Material::reflects() const{
     return _local < 1.0;
 }
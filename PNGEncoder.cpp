@@ -0,0 +1,456 @@
+
+
+#include "PNGEncoder.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "Screen.hpp"
+
+namespace {
+    const unsigned channels = 3; // RGB, our pixels are always opaque
+
+    // ---------------------------------------------------------------- filtering
+
+    unsigned char paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) {
+            return (unsigned char) a;
+        }
+        return (unsigned char) (pb <= pc ? b : c);
+    }
+
+    // PNG filter type on one row, prev is the unfiltered row above (nullptr for the first row)
+    void filterRow(unsigned char* out, const unsigned char* row, const unsigned char* prev, size_t length, unsigned type) {
+        for (size_t i = 0; i < length; ++i) {
+            int left = i >= channels ? row[i - channels] : 0;
+            int up = prev ? prev[i] : 0;
+            int upLeft = prev && i >= channels ? prev[i - channels] : 0;
+            switch (type) {
+                case 0: out[i] = row[i]; break;
+                case 1: out[i] = (unsigned char) (row[i] - left); break;
+                case 2: out[i] = (unsigned char) (row[i] - up); break;
+                case 3: out[i] = (unsigned char) (row[i] - ((left + up) >> 1)); break;
+                default: out[i] = (unsigned char) (row[i] - paeth(left, up, upLeft)); break;
+            }
+        }
+    }
+
+    // Picks the filter per row the way lodepng does by default: the one with the smallest sum of absolute (signed)
+    // values, which usually compresses best. The first row of a strip has no row above that belongs to the strip,
+    // so it only tries None and Sub. The strip before may not even be rendered yet.
+    // The Store profile skips filtering (type None everywhere), Fast doesn't search and uses Up (Sub on the first row).
+    void filterRows(std::vector<unsigned char>& out, const std::vector<unsigned char>& rows, uint64_t rowCount, size_t rowLength, PNGProfile profile) {
+        out.resize(rowCount * (rowLength + 1));
+        std::vector<unsigned char> attempt(rowLength);
+        for (uint64_t y = 0; y < rowCount; ++y) {
+            const unsigned char* row = &rows[y * rowLength];
+            const unsigned char* prev = y > 0 ? row - rowLength : nullptr;
+            unsigned char* target = &out[y * (rowLength + 1)];
+            if (profile == PNGProfile::Store || profile == PNGProfile::Fast) {
+                unsigned type = profile == PNGProfile::Store ? 0 : prev ? 2 : 1;
+                target[0] = (unsigned char) type;
+                filterRow(target + 1, row, prev, rowLength, type);
+                continue;
+            }
+            uint64_t smallest = UINT64_MAX;
+            for (unsigned type = 0; type < (prev ? 5u : 2u); ++type) {
+                filterRow(attempt.data(), row, prev, rowLength, type);
+                uint64_t sum = 0;
+                for (unsigned char value : attempt) {
+                    sum += value < 128 ? value : 256 - value;
+                }
+                if (sum < smallest) {
+                    smallest = sum;
+                    target[0] = (unsigned char) type;
+                    std::memcpy(target + 1, attempt.data(), rowLength);
+                }
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------- deflate stream scanning
+
+    // lodepng pads its deflate output to whole bytes and marks the last block as final. To chain several streams we
+    // need to know where exactly the last block starts and ends, so this walks over the blocks without decoding
+    // them (it's the canonical Huffman decoder of zlib's puff.c, minus the output)
+    class DeflateScanner {
+        const unsigned char* _data;
+        uint64_t _size;
+        uint64_t _bit = 0;
+        bool _overrun = false;
+
+        struct Huffman {
+            uint16_t _count[16] = {};
+            uint16_t _symbol[288] = {};
+        };
+
+        unsigned bits(unsigned n) {
+            unsigned value = 0;
+            for (unsigned i = 0; i < n; ++i, ++_bit) {
+                if ((_bit >> 3) >= _size) {
+                    _overrun = true;
+                    return 0;
+                }
+                value |= ((_data[_bit >> 3] >> (_bit & 7)) & 1u) << i;
+            }
+            return value;
+        }
+
+        static void build(Huffman& h, const unsigned char* lengths, unsigned n) {
+            uint16_t offsets[16] = {};
+            for (unsigned i = 0; i < n; ++i) {
+                h._count[lengths[i]]++;
+            }
+            h._count[0] = 0;
+            for (unsigned len = 1; len < 15; ++len) {
+                offsets[len + 1] = offsets[len] + h._count[len];
+            }
+            for (unsigned i = 0; i < n; ++i) {
+                if (lengths[i] != 0) {
+                    h._symbol[offsets[lengths[i]]++] = (uint16_t) i;
+                }
+            }
+        }
+
+        int decode(const Huffman& h) {
+            int code = 0, first = 0, index = 0;
+            for (unsigned len = 1; len <= 15; ++len) {
+                code |= (int) bits(1);
+                int count = h._count[len];
+                if (code - count < first) {
+                    return h._symbol[index + (code - first)];
+                }
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            _overrun = true;
+            return 256;
+        }
+
+        bool skipCodes(const Huffman& literals, const Huffman& distances) {
+            static const unsigned char lengthExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+            while (!_overrun) {
+                int symbol = decode(literals);
+                if (symbol == 256) {
+                    return true;
+                }
+                if (symbol > 256) {
+                    if (symbol > 285) {
+                        return false;
+                    }
+                    bits(lengthExtra[symbol - 257]);
+                    int distance = decode(distances);
+                    if (distance > 29) {
+                        return false;
+                    }
+                    bits(distance < 4 ? 0 : distance / 2 - 1);
+                }
+            }
+            return false;
+        }
+
+        bool skipFixed() {
+            unsigned char lengths[288];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            Huffman literals, distances;
+            build(literals, lengths, 288);
+            std::fill(lengths, lengths + 30, 5);
+            build(distances, lengths, 30);
+            return skipCodes(literals, distances);
+        }
+
+        bool skipDynamic() {
+            static const unsigned char order[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+            unsigned literalCount = bits(5) + 257;
+            unsigned distanceCount = bits(5) + 1;
+            unsigned codeCount = bits(4) + 4;
+            unsigned char lengths[320] = {};
+            for (unsigned i = 0; i < codeCount; ++i) {
+                lengths[order[i]] = (unsigned char) bits(3);
+            }
+            Huffman codeLengths;
+            build(codeLengths, lengths, 19);
+            unsigned index = 0;
+            while (index < literalCount + distanceCount && !_overrun) {
+                int symbol = decode(codeLengths);
+                unsigned char value = 0;
+                unsigned repeat;
+                if (symbol < 16) {
+                    lengths[index++] = (unsigned char) symbol;
+                    continue;
+                } else if (symbol == 16) {
+                    if (index == 0) {
+                        return false;
+                    }
+                    value = lengths[index - 1];
+                    repeat = 3 + bits(2);
+                } else if (symbol == 17) {
+                    repeat = 3 + bits(3);
+                } else {
+                    repeat = 11 + bits(7);
+                }
+                if (index + repeat > literalCount + distanceCount) {
+                    return false;
+                }
+                std::fill(lengths + index, lengths + index + repeat, value);
+                index += repeat;
+            }
+            Huffman literals, distances;
+            build(literals, lengths, literalCount);
+            build(distances, lengths + literalCount, distanceCount);
+            return skipCodes(literals, distances);
+        }
+    public:
+        DeflateScanner(const unsigned char* data, uint64_t size) : _data(data), _size(size) {}
+
+        // finds the bit where the final block starts and the bit after its end of block code
+        bool scan(uint64_t& finalBlockBit, uint64_t& endBit) {
+            while (!_overrun) {
+                uint64_t start = _bit;
+                bool last = bits(1) != 0;
+                unsigned type = bits(2);
+                bool ok;
+                if (type == 0) {
+                    _bit = (_bit + 7) & ~uint64_t(7);
+                    unsigned length = bits(16);
+                    bits(16);
+                    _bit += uint64_t(length) * 8;
+                    ok = (_bit >> 3) <= _size;
+                } else if (type == 1) {
+                    ok = skipFixed();
+                } else if (type == 2) {
+                    ok = skipDynamic();
+                } else {
+                    ok = false;
+                }
+                if (!ok || _overrun) {
+                    return false;
+                }
+                if (last) {
+                    finalBlockBit = start;
+                    endBit = _bit;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // ---------------------------------------------------------------- stitching
+
+    // appends the first bitCount bits of data to a bit stream that currently ends at bit bitSize
+    void appendBits(std::vector<unsigned char>& out, uint64_t& bitSize, const std::vector<unsigned char>& data, uint64_t bitCount) {
+        unsigned shift = bitSize & 7;
+        uint64_t byteCount = (bitCount + 7) / 8;
+        if (shift == 0) {
+            out.insert(out.end(), data.begin(), data.begin() + byteCount);
+        } else {
+            for (uint64_t i = 0; i < byteCount; ++i) {
+                out.back() |= (unsigned char) (data[i] << shift);
+                out.push_back((unsigned char) (data[i] >> (8 - shift)));
+            }
+        }
+        bitSize += bitCount;
+        out.resize((bitSize + 7) / 8);
+        if (bitSize & 7) {
+            out.back() &= (unsigned char) ((1u << (bitSize & 7)) - 1); // drop the padding that came along
+        }
+    }
+
+    // adler32 of two pieces of data put together, from the adler32s of the pieces (zlib's adler32_combine)
+    uint32_t combineAdler(uint32_t first, uint32_t second, uint64_t secondLength) {
+        const uint32_t base = 65521;
+        uint32_t remainder = (uint32_t) (secondLength % base);
+        uint32_t sum1 = first & 0xffff;
+        uint32_t sum2 = (uint32_t) ((uint64_t(remainder) * sum1) % base);
+        sum1 += (second & 0xffff) + base - 1;
+        sum2 += (first >> 16) + (second >> 16) + base - remainder;
+        if (sum1 >= base) sum1 -= base;
+        if (sum1 >= base) sum1 -= base;
+        if (sum2 >= 2 * base) sum2 -= 2 * base;
+        if (sum2 >= base) sum2 -= base;
+        return sum1 | (sum2 << 16);
+    }
+
+    uint32_t adler32(const std::vector<unsigned char>& data) {
+        uint32_t a = 1, b = 0;
+        size_t i = 0;
+        while (i < data.size()) {
+            size_t end = std::min(data.size(), i + 5552); // the most bytes before the sums can overflow
+            for (; i < end; ++i) {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return a | (b << 16);
+    }
+
+    void appendUint32(std::vector<unsigned char>& out, uint32_t value) {
+        out.push_back((unsigned char) (value >> 24));
+        out.push_back((unsigned char) (value >> 16));
+        out.push_back((unsigned char) (value >> 8));
+        out.push_back((unsigned char) value);
+    }
+
+    void appendChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data) {
+        appendUint32(png, (uint32_t) data.size());
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        appendUint32(png, lodepng_crc32(&png[start], png.size() - start));
+    }
+}
+
+const char* toString(PNGProfile profile) {
+    switch (profile) {
+        case PNGProfile::Store: return "store";
+        case PNGProfile::Fast: return "fast";
+        case PNGProfile::Default: return "default";
+        case PNGProfile::Max: return "max";
+    }
+    return "";
+}
+
+bool parsePNGProfile(const std::string& name, PNGProfile& profile) {
+    for (PNGProfile candidate : {PNGProfile::Store, PNGProfile::Fast, PNGProfile::Default, PNGProfile::Max}) {
+        if (name == toString(candidate)) {
+            profile = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+PNGEncoder::PNGEncoder(uint64_t width, uint64_t height, uint64_t stripHeight)
+    : _width(width), _height(height), _stripHeight(std::max<uint64_t>(stripHeight, 1)) {
+    lodepng_compress_settings_init(&_settings);
+    _strips.resize((height + _stripHeight - 1) / _stripHeight);
+}
+
+uint64_t PNGEncoder::getStripHeight() const {
+    return _stripHeight;
+}
+
+uint64_t PNGEncoder::getStripCount() const {
+    return _strips.size();
+}
+
+void PNGEncoder::setProfile(PNGProfile profile) {
+    _profile = profile;
+    lodepng_compress_settings_init(&_settings);
+    switch (profile) {
+        case PNGProfile::Store:
+            _settings.btype = 0;
+            break;
+        case PNGProfile::Fast:
+            // lodepng follows at most windowsize / 8 hash chain entries, so the small window also keeps the chains short
+            _settings.windowsize = 256;
+            _settings.nicematch = 32;
+            _settings.lazymatching = 0;
+            break;
+        case PNGProfile::Default:
+            break;
+        case PNGProfile::Max:
+            _settings.windowsize = 32768;
+            _settings.nicematch = 258;
+            break;
+    }
+}
+
+PNGProfile PNGEncoder::getProfile() const {
+    return _profile;
+}
+
+void PNGEncoder::encodeStrip(const Screen& screen, uint64_t strip) {
+    uint64_t y0 = strip * _stripHeight;
+    uint64_t y1 = std::min(y0 + _stripHeight, _height);
+    size_t rowLength = _width * channels;
+    std::vector<unsigned char> rows(rowLength * (y1 - y0));
+    unsigned char* target = rows.data();
+    for (uint64_t y = y0; y < y1; ++y) {
+        for (uint64_t x = 0; x < _width; ++x) {
+            color pixel = screen.getPixel(x, y);
+            *target++ = (unsigned char) int(255.999 * pixel.x());
+            *target++ = (unsigned char) int(255.999 * pixel.y());
+            *target++ = (unsigned char) int(255.999 * pixel.z());
+        }
+    }
+    std::vector<unsigned char> filtered;
+    filterRows(filtered, rows, y1 - y0, rowLength, _profile);
+
+    Strip& result = _strips[strip];
+    result._encoded = true;
+    result._adler = adler32(filtered);
+    result._filteredSize = filtered.size();
+    unsigned char* deflated = nullptr;
+    size_t deflatedSize = 0;
+    result._error = lodepng_deflate(&deflated, &deflatedSize, filtered.data(), filtered.size(), &_settings);
+    if (!result._error) {
+        result._deflated.assign(deflated, deflated + deflatedSize);
+        DeflateScanner scanner(result._deflated.data(), result._deflated.size());
+        if (!scanner.scan(result._finalBlockBit, result._bitCount)) {
+            result._error = 52; // lodepng's "invalid zlib data"
+        }
+    }
+    free(deflated);
+}
+
+void PNGEncoder::encodeRows(const Screen& screen, uint64_t y0, uint64_t y1) {
+    // The rows have to start and end at strip borders (or the bottom of the image), a strip can't be deflated in
+    // parts. If they don't, whoever calls this cuts the image differently from us; rather than writing a PNG with
+    // rows missing or twice, the strip the rows start in gets an error that finish() reports
+    if (y0 >= y1 || y1 > _height || y0 % _stripHeight != 0 || (y1 % _stripHeight != 0 && y1 != _height)) {
+        if (y0 / _stripHeight < _strips.size()) {
+            _strips[y0 / _stripHeight]._error = 84; // lodepng's "image too small to contain all pixels"
+        }
+        return;
+    }
+    for (uint64_t strip = y0 / _stripHeight; strip * _stripHeight < y1; ++strip) {
+        encodeStrip(screen, strip);
+    }
+}
+
+unsigned PNGEncoder::finish(std::vector<unsigned char>& png) const {
+    // one zlib stream: header, the deflate streams of all strips back to back with every BFINAL but the last one
+    // cleared, and the adler32 of all filtered rows
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    uint64_t bitSize = zlib.size() * 8;
+    uint32_t adler = 1;
+    for (size_t i = 0; i < _strips.size(); ++i) {
+        const Strip& strip = _strips[i];
+        if (strip._error) {
+            return strip._error;
+        }
+        if (!strip._encoded) {
+            return 84; // some rows never got to the encoder
+        }
+        uint64_t finalBlockBit = bitSize + strip._finalBlockBit;
+        appendBits(zlib, bitSize, strip._deflated, strip._bitCount);
+        if (i + 1 < _strips.size()) {
+            zlib[finalBlockBit >> 3] &= (unsigned char) ~(1u << (finalBlockBit & 7));
+        }
+        adler = i == 0 ? strip._adler : combineAdler(adler, strip._adler, strip._filteredSize);
+    }
+    appendUint32(zlib, adler);
+
+    std::vector<unsigned char> header;
+    appendUint32(header, (uint32_t) _width);
+    appendUint32(header, (uint32_t) _height);
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit, RGB, deflate, adaptive filtering, no interlacing
+
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    png.assign(signature, signature + 8);
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", zlib);
+    appendChunk(png, "IEND", {});
+    return 0;
+}
@@ -0,0 +1,74 @@
+
+
+#ifndef PNGENCODER_HPP
+#define PNGENCODER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "lodepng.h"
+
+class Screen;
+
+// How hard the encoder tries to make the file small:
+// Store   no filtering, no compression at all (deflate "stored" blocks). Big files, almost no work
+// Fast    the Up filter on every row, a small LZ77 window (short hash chains) and no lazy matching. For previews
+// Default lodepng's defaults: per row the filter with the smallest sum, 2048 byte window
+// Max     like Default with the full 32k window and the longest matches. Slowest, smallest
+enum class PNGProfile { Store, Fast, Default, Max };
+
+const char* toString(PNGProfile profile);
+bool parsePNGProfile(const std::string& name, PNGProfile& profile); // false if there's no profile with that name
+
+// what an encode took and gave
+struct PNGEncodeStats {
+    PNGProfile _profile;
+    double _seconds;
+    uint64_t _bytes;
+    unsigned _error; // lodepng error code, 0 if all went well
+};
+
+// Encodes a Screen as an 8 bit RGB PNG in horizontal strips that can be worked on in parallel. Every strip is
+// filtered and deflated on its own (with lodepng's deflate), which only needs the strip's own rows, so a strip can
+// be encoded as soon as the renderer is done with it, while the rest of the frame is still being rendered.
+// finish() then stitches the deflate streams of all strips together into the single zlib stream of one IDAT chunk.
+//
+// The price is that LZ77 matches can't reach back into the strip before, which costs a little compression at the
+// strip borders, and that the first row of a strip can't use the filters that look at the row above.
+class PNGEncoder {
+    struct Strip {
+        std::vector<unsigned char> _deflated; // raw deflate stream, the last block has BFINAL set
+        uint64_t _bitCount = 0;               // where the stream really ends, the rest of the last byte is padding
+        uint64_t _finalBlockBit = 0;          // position of the BFINAL bit of the last block
+        uint32_t _adler = 1;                  // adler32 of the filtered rows
+        uint64_t _filteredSize = 0;
+        unsigned _error = 0;
+        bool _encoded = false;                // finish() refuses strips that never were
+    };
+
+    uint64_t _width;
+    uint64_t _height;
+    uint64_t _stripHeight;
+    PNGProfile _profile = PNGProfile::Default;
+    LodePNGCompressSettings _settings;
+    std::vector<Strip> _strips;
+public:
+    PNGEncoder(uint64_t width, uint64_t height, uint64_t stripHeight = 32);
+
+    uint64_t getStripHeight() const;
+    uint64_t getStripCount() const;
+    void setProfile(PNGProfile profile);
+    PNGProfile getProfile() const;
+
+    // Filters and deflates rows [strip * stripHeight, (strip + 1) * stripHeight) of the screen. Different strips
+    // may be encoded at the same time on different threads
+    void encodeStrip(const Screen& screen, uint64_t strip);
+    // the same for every strip in rows [y0, y1), which have to start and end at strip borders (the last strip ends at
+    // the bottom of the image). Other ranges make finish() fail
+    void encodeRows(const Screen& screen, uint64_t y0, uint64_t y1);
+    // Puts the PNG file together once every strip has been encoded, returns a lodepng error code (0 if all went well)
+    unsigned finish(std::vector<unsigned char>& png) const;
+};
+
+#endif //PNGENCODER_HPP
@@ -0,0 +1,149 @@
+
+
+#include "PixelFormat.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    // 4x4 Bayer matrix, the thresholds of ordered dithering in sixteenths
+    const unsigned char bayer[16] = {0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5};
+
+    unsigned char ditherToByte(double value, uint64_t x, uint64_t y) {
+        // adding a threshold in [0,1) before rounding down rounds up just as often as the fraction says, so over a
+        // 4x4 block the average comes out right instead of every pixel of a gradient snapping to the same step
+        double threshold = (bayer[(y & 3) * 4 + (x & 3)] + 0.5) / 16.0;
+        double scaled = std::floor(value * 255.0 + threshold);
+        return (unsigned char) (scaled < 0.0 ? 0.0 : scaled > 255.0 ? 255.0 : scaled);
+    }
+}
+
+const char* toString(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::RGB64F: return "rgb64f";
+        case PixelFormat::RGB32F: return "rgb32f";
+        case PixelFormat::RGBA16F: return "rgba16f";
+        case PixelFormat::RGBA8: return "rgba8";
+    }
+    return "";
+}
+
+bool parsePixelFormat(const std::string& name, PixelFormat& format) {
+    for (PixelFormat candidate : {PixelFormat::RGB64F, PixelFormat::RGB32F, PixelFormat::RGBA16F, PixelFormat::RGBA8}) {
+        if (name == toString(candidate)) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t bytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::RGB64F: return 3 * sizeof(double);
+        case PixelFormat::RGB32F: return 3 * sizeof(float);
+        case PixelFormat::RGBA16F: return 4 * sizeof(uint16_t);
+        case PixelFormat::RGBA8: return 4;
+    }
+    return 0;
+}
+
+uint32_t channelCount(PixelFormat format) {
+    return format == PixelFormat::RGB64F || format == PixelFormat::RGB32F ? 3 : 4;
+}
+
+uint16_t floatToHalf(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent == 0xff) {
+        return (uint16_t) (sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0)); // infinity stays infinity, NaN stays NaN
+    }
+    int halfExponent = (int) exponent - 127 + 15;
+    if (halfExponent >= 31) {
+        return (uint16_t) (sign | 0x7c00);
+    }
+    uint32_t shift = 13;
+    uint32_t half;
+    if (halfExponent <= 0) {
+        // too small for a normal half: a subnormal one (the implicit 1 becomes explicit), or zero
+        if (halfExponent < -10) {
+            return (uint16_t) sign;
+        }
+        mantissa |= 0x800000;
+        shift = 14 - halfExponent;
+        half = mantissa >> shift;
+    } else {
+        half = ((uint32_t) halfExponent << 10) | (mantissa >> shift);
+    }
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+        half++; // a carry out of the mantissa correctly bumps the exponent
+    }
+    return (uint16_t) (sign | half);
+}
+
+float halfToFloat(uint16_t half) {
+    uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    if (exponent == 0) {
+        float value = (float) mantissa * (1.0f / 16777216.0f); // subnormal (or zero): mantissa * 2^-24
+        return sign ? -value : value;
+    }
+    if (exponent == 31) {
+        return std::bit_cast<float>(sign | 0x7f800000 | (mantissa << 13));
+    }
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+void storePixel(PixelFormat format, unsigned char* target, const vec3& c, uint64_t x, uint64_t y) {
+    switch (format) {
+        case PixelFormat::RGB64F:
+            std::memcpy(target, c._elements, 3 * sizeof(double));
+            break;
+        case PixelFormat::RGB32F: {
+            float values[3] = {(float) c[0], (float) c[1], (float) c[2]};
+            std::memcpy(target, values, sizeof(values));
+            break;
+        }
+        case PixelFormat::RGBA16F: {
+            uint16_t values[4] = {floatToHalf((float) c[0]), floatToHalf((float) c[1]), floatToHalf((float) c[2]), 0x3c00};
+            std::memcpy(target, values, sizeof(values));
+            break;
+        }
+        case PixelFormat::RGBA8:
+            target[0] = ditherToByte(c[0], x, y);
+            target[1] = ditherToByte(c[1], x, y);
+            target[2] = ditherToByte(c[2], x, y);
+            target[3] = 255;
+            break;
+    }
+}
+
+vec3 loadPixel(PixelFormat format, const unsigned char* source) {
+    switch (format) {
+        case PixelFormat::RGB64F: {
+            vec3 c;
+            std::memcpy(c._elements, source, 3 * sizeof(double));
+            return c;
+        }
+        case PixelFormat::RGB32F: {
+            float values[3];
+            std::memcpy(values, source, sizeof(values));
+            return vec3(values[0], values[1], values[2]);
+        }
+        case PixelFormat::RGBA16F: {
+            uint16_t values[4];
+            std::memcpy(values, source, sizeof(values));
+            return vec3(halfToFloat(values[0]), halfToFloat(values[1]), halfToFloat(values[2]));
+        }
+        case PixelFormat::RGBA8:
+            // byte / 255 turns back into the same byte with the int(255.999 * value) of the writers
+            return vec3(source[0] / 255.0, source[1] / 255.0, source[2] / 255.0);
+    }
+    return vec3();
+}
@@ -0,0 +1,32 @@
+
+
+#ifndef PIXELFORMAT_HPP
+#define PIXELFORMAT_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "Vector3.hpp"
+
+// How Screen stores its pixels. The rendering always works with doubles, the format only decides what's kept:
+// RGB64F   three doubles, 24 bytes. Exactly what was rendered
+// RGB32F   three floats, 12 bytes. Still far more precise than any 8 bit output
+// RGBA16F  four half floats (alpha always 1), 8 bytes. Like the usual EXR/GPU framebuffers
+// RGBA8    four bytes (alpha always 255), 4 bytes. Rounded with ordered dithering so smooth gradients don't band;
+//          written out as 8 bit, these are exactly the bytes that end up in the file
+enum class PixelFormat { RGB64F, RGB32F, RGBA16F, RGBA8 };
+
+const char* toString(PixelFormat format);
+bool parsePixelFormat(const std::string& name, PixelFormat& format); // false if there's no format with that name
+uint32_t bytesPerPixel(PixelFormat format);
+uint32_t channelCount(PixelFormat format);
+
+// IEEE 754 binary16, rounded to nearest even. Values too big for a half become infinity
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t half);
+
+// writes color c, the pixel at (x, y), to target in the given format. x and y pick the dither threshold for RGBA8
+void storePixel(PixelFormat format, unsigned char* target, const vec3& c, uint64_t x, uint64_t y);
+vec3 loadPixel(PixelFormat format, const unsigned char* source);
+
+#endif //PIXELFORMAT_HPP
@@ -2,12 +2,14 @@
 
 #include "Ray.hpp"
 
+#include <algorithm>
+
 #include "Intersection.hpp"
 #include "Sphere.hpp"
 
 Ray::Ray(vec3 origin, vec3 direction) : _origin(origin), _direction(direction) {}
 
-std::optional<Intersection> Ray::intersects(Sphere& sphere) const {
+std::optional<double> Ray::intersects(const Sphere& sphere, double tMax) const {
         //first we get the distance vector from the ray origin to the sphere center
     vec3 dist= sphere._center - this->_origin;  // note: this refers to our ray object we pass in Scene::intersect method, we use ray.intersects(sphere) inside that method
 
@@ -29,17 +31,32 @@ std::optional<Intersection> Ray::intersects(Sphere& sphere) const {
     }
 
 //if we are here, that means sphere radius is big enough to touch the ray
+    // but if even the near side of the sphere is further away than tMax we're done: d_projection - d_close > tMax is
+    // (d_projection - tMax)^2 > d_close^2 when d_projection - tMax is positive, and that needs no sqrt
+    double ahead = d_projection - tMax;
+    if (ahead > 0 && ahead * ahead > radius2 - dist2) {
+        return {};
+    }
     double d_close = sqrt(radius2 - dist2);  // result after subtracting perpendicular distance from radius
     double t = d_projection - d_close;  // First intersection point
     if (t<0)
     {t= d_projection + d_close;}
 
-    //vec3 intersection_point = this->_origin + this->_direction * t;
-    vec3 intersection_point = point_at(t);
-    vec3 normal = unit_vector(intersection_point - sphere._center);
+    // the normal is only needed for the closest of all hits, so we leave it to the caller (see Intersection)
+    return t;
 
-    return std::optional<Intersection>(Intersection(sphere._material, normal, t));
+}
 
+std::optional<double> Ray::intersectsFromSurface(const vec3& center, double radiusSquared) const {
+    vec3 dist = center - _origin;
+    double d_projection = dot(dist, _direction);
+    if (d_projection <= 0) {
+        return {}; // the ray leaves the sphere (the surface is curved away from it), there's nothing left to hit
+    }
+    // the ray goes into the sphere, and it comes out again on the far side: the far solution of intersects().
+    // The origin is on the surface only up to rounding, so dist2 can come out a hair above radiusSquared
+    double dist2 = dist.length_squared() - d_projection * d_projection;
+    return d_projection + sqrt(std::max(0.0, radiusSquared - dist2));
 }
 
 vec3 Ray::point_at(double t) const {
@@ -2,6 +2,7 @@
 
 #ifndef RAY_HPP
 #define RAY_HPP
+#include <limits>
 #include <optional>
 #include "Intersection.hpp"
 #include "Sphere.hpp"
@@ -13,7 +14,14 @@ struct Ray {
     vec3 _direction;
 
     Ray(vec3 origin, vec3 direction);
-    std::optional<Intersection> intersects( Sphere& ray) const;
+    // distance to the sphere along the ray. Only the distance, the normal is left to Intersection. A sphere that is
+    // only hit beyond tMax (the closest hit the caller has so far) may be reported as missed, without the sqrt
+    std::optional<double> intersects(const Sphere& sphere, double tMax = std::numeric_limits<double>::infinity()) const;
+    // The same for a ray that starts on the surface of the sphere (center, radius squared), i.e. one that was
+    // reflected or refracted there: it can only hit that sphere again on the far side, and only if it goes into it.
+    // Unlike intersects() this never finds the surface the ray starts on, however far off it the rounding put the
+    // origin, so the ray doesn't have to be pushed off the surface by some epsilon first
+    std::optional<double> intersectsFromSurface(const vec3& center, double radiusSquared) const;
     vec3 point_at(double t) const;
 };
 
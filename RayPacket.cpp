@@ -0,0 +1,78 @@
+
+
+#include "RayPacket.hpp"
+
+#include <bit>
+#include <limits>
+
+RayPacket::RayPacket(vec3 origin) : _origin(origin), _activeMask(0) {
+    for (uint32_t lane = 0; lane < size; ++lane) {
+        _directionX[lane] = _directionY[lane] = _directionZ[lane] = 0.0;
+        _inverseX[lane] = _inverseY[lane] = _inverseZ[lane] = 0.0;
+        _hits[lane] = Hit{std::numeric_limits<double>::infinity(), UINT32_MAX};
+    }
+}
+
+void RayPacket::setRay(uint32_t lane, const vec3& direction) {
+    _directionX[lane] = direction.x();
+    _directionY[lane] = direction.y();
+    _directionZ[lane] = direction.z();
+    _inverseX[lane] = 1.0 / direction.x();
+    _inverseY[lane] = 1.0 / direction.y();
+    _inverseZ[lane] = 1.0 / direction.z();
+    _activeMask |= 1u << lane;
+}
+
+void RayPacket::setRays(const Directions& directions, uint32_t mask) {
+    directions.store(mask, _directionX, _directionY, _directionZ);
+    (1.0 / directions._x).store(mask, _inverseX);
+    (1.0 / directions._y).store(mask, _inverseY);
+    (1.0 / directions._z).store(mask, _inverseZ);
+    _activeMask |= mask;
+}
+
+bool RayPacket::isActive(uint32_t lane) const {
+    return (_activeMask >> lane) & 1u;
+}
+
+Ray RayPacket::getRay(uint32_t lane) const {
+    return Ray(_origin, vec3(_directionX[lane], _directionY[lane], _directionZ[lane]));
+}
+
+bool RayPacket::entersBox(const AABB& box) const {
+    // the slab test of AABB::intersects, per ray. All rays share the origin, so the distances to the slab planes
+    // only need to be computed once; they're then scaled by each ray's inverse direction
+    double nearX = box._min.x() - _origin.x(), farX = box._max.x() - _origin.x();
+    double nearY = box._min.y() - _origin.y(), farY = box._max.y() - _origin.y();
+    double nearZ = box._min.z() - _origin.z(), farZ = box._max.z() - _origin.z();
+    for (uint32_t lanes = _activeMask; lanes != 0; lanes &= lanes - 1) {
+        uint32_t lane = std::countr_zero(lanes);
+        double t0 = 0.0;
+        double t1 = _hits[lane]._t;
+        const double slabs[3][3] = {{nearX, farX, _inverseX[lane]}, {nearY, farY, _inverseY[lane]}, {nearZ, farZ, _inverseZ[lane]}};
+        bool inside = true;
+        for (const auto& slab : slabs) {
+            double tNear = slab[0] * slab[2];
+            double tFar = slab[1] * slab[2];
+            if (tNear > tFar) {
+                std::swap(tNear, tFar);
+            }
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+            if (t0 > t1) {
+                inside = false;
+                break;
+            }
+        }
+        if (inside) {
+            return true; // one ray is enough, the whole packet goes in
+        }
+    }
+    return false;
+}
+
+bool RayPacket::isNegative(uint32_t axis) const {
+    uint32_t lane = _activeMask == 0 ? 0 : std::countr_zero(_activeMask);
+    const double* direction[3] = {_directionX, _directionY, _directionZ};
+    return direction[axis][lane] < 0;
+}
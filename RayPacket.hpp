@@ -0,0 +1,49 @@
+
+
+#ifndef RAYPACKET_HPP
+#define RAYPACKET_HPP
+
+#include <cstdint>
+
+#include "BVH.hpp"
+#include "Intersection.hpp"
+#include "Ray.hpp"
+#include "Vector3.hpp"
+#include "Vector3x.hpp"
+
+// A 4x4 block of primary rays. They all start at the eye and point in almost the same direction, so they tend to
+// pass through the same BVH boxes and hit the same spheres. Tracing them together lets one box test or one sphere
+// fetch serve all 16 of them, and the sphere test runs over several rays at once in SIMD lanes.
+// The directions are stored as one array per coordinate, like the spheres in a SpherePack.
+struct RayPacket {
+    static constexpr uint32_t width = 4;
+    static constexpr uint32_t height = 4;
+    static constexpr uint32_t size = width * height;
+
+    vec3 _origin; // shared by all rays
+    alignas(32) double _directionX[size];
+    alignas(32) double _directionY[size];
+    alignas(32) double _directionZ[size];
+    alignas(32) double _inverseX[size];
+    alignas(32) double _inverseY[size];
+    alignas(32) double _inverseZ[size];
+    Hit _hits[size];       // closest hit per ray, _index is noHit (SpherePack::noHit) until something is hit
+    uint32_t _activeMask;  // bit i set: lane i holds a ray. Lanes outside the screen stay inactive
+
+    // the directions of all lanes at once, as basic_vec3x
+    using Directions = basic_vec3x<double, size>;
+
+    explicit RayPacket(vec3 origin);
+    void setRay(uint32_t lane, const vec3& direction);
+    // setRay for every lane in mask at once
+    void setRays(const Directions& directions, uint32_t mask);
+    bool isActive(uint32_t lane) const;
+    Ray getRay(uint32_t lane) const;
+
+    // does at least one active ray enter the box in front of its closest hit so far?
+    bool entersBox(const AABB& box) const;
+    // sign of the direction along an axis, taken from the first active ray. Used to pick the nearer BVH child
+    bool isNegative(uint32_t axis) const;
+};
+
+#endif //RAYPACKET_HPP
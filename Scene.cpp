@@ -3,8 +3,81 @@
 
 #include "Scene.hpp"
 
+#include <limits>
+#include <type_traits>
+
+RayCounters& RayCounters::operator+=(const RayCounters& other){
+    _primary += other._primary;
+    _secondary += other._secondary;
+    _shadow += other._shadow;
+    return *this;
+}
+
+RayCounters RayCounters::operator-(const RayCounters& other) const{
+    RayCounters difference;
+    difference._primary = _primary - other._primary;
+    difference._secondary = _secondary - other._secondary;
+    difference._shadow = _shadow - other._shadow;
+    return difference;
+}
+
+RayCounters& Scene::threadCounters(){
+    // thread_local, so the render threads never write to the same counter
+    thread_local RayCounters counters;
+    return counters;
+}
+
+MaterialIndex Scene::addMaterial(Material material){
+    materials.push_back(material);
+    return (MaterialIndex) (materials.size() - 1);
+}
+
 void Scene::addSphere(Sphere object){
     spheres.push_back(object);
+    bvh.clear(); // the tree doesn't know about the new sphere, build() has to be called again
+    pack.clear();
+    packF.clear();
+    cache.reset();
+}
+
+uint64_t Scene::sphereCount() const{
+    return spheres.empty() ? pack.size() : spheres.size();
+}
+
+void Scene::addLight(Light light){
+    lights.push_back(light);
+}
+
+template<typename Real>
+void Scene::build(){
+    if(bvh.empty()){
+        bvh.build(spheres);
+        pack.build(spheres, materials, bvh.getIndices());
+    } // else nothing has changed since the last build, or the scene came from a cache
+    if constexpr (std::is_same_v<Real, float>) {
+        if(packF.size() != pack.size()){
+            packF.build(pack); // from the double pack, so this works for cached scenes too
+        }
+    }
+}
+
+template<typename Real>
+bool Scene::isBuilt() const{
+    // no spheres at all means no BVH either, the linear scan is all there is
+    bool built = !bvh.empty() || spheres.empty();
+    if constexpr (std::is_same_v<Real, float>) {
+        built = built && packF.size() == pack.size();
+    }
+    return built;
+}
+
+template<typename Real>
+const BasicSpherePack<Real>& Scene::getPack() const{
+    if constexpr (std::is_same_v<Real, float>) {
+        return packF;
+    } else {
+        return pack;
+    }
 }
 
 
@@ -12,26 +85,111 @@ const vec3 Scene::getBackgroundColor() const{
     return backgroundColor;
 }
 
-std::optional<Intersection> Scene::intersect(const Ray& ray) const{
+template<typename Real>
+std::optional<Intersection> Scene::intersect(const Ray& ray, uint32_t origin) const{
 
-    std::optional<Intersection> result = {};
+    if(bvh.empty()){
+        return intersectLinear(ray, origin); // build() hasn't been called (yet)
+    }
 
-    for(auto object : spheres){
+    // Same result as the linear scan below, but we only test the spheres in the leaves of the BVH that the ray
+    // passes through, nearest leaves first. Every hit lowers the distance to beat, which lets the traversal skip
+    // boxes behind it. The pack stores the spheres in leaf order, so every leaf is one contiguous run that the SIMD
+    // test eats in one go. We only remember the distance and the index of the closest sphere, the normal and
+    // material are looked up once at the end.
+    // A ray that leaves a sphere can only hit that sphere again on its far side. That hit is worked out on its own
+    // before the traversal (it even gives the traversal a distance to beat) and the sphere is skipped in the leaves,
+    // where the near solution would find the very spot the ray starts from.
+    Hit best{std::numeric_limits<double>::infinity(), SpherePack::noHit};
+    const BasicSpherePack<Real>& spheresInLeafOrder = getPack<Real>();
+    if(origin != SpherePack::noHit){
+        spheresInLeafOrder.intersectFromSurface(ray, origin, best);
+    }
+    bvh.traverse(ray, best._t, [&](uint32_t first, uint32_t count){
+        spheresInLeafOrder.intersect(ray, first, count, best, origin);
+        return false;
+    });
 
-        std::optional<Intersection> i = ray.intersects(object);
+    if(best._index == SpherePack::noHit){
+        return {};
+    }
+    return Intersection(ray, spheresInLeafOrder.getCenter(best._index), spheresInLeafOrder.getMaterial(best._index), best._t, best._index);
+}
 
-        if( !i.has_value()){
+// Closest hits for a whole packet of rays that share their origin. The packet walks the BVH as one: a box is opened
+// if any of its rays enters it, and every leaf is tested against all active rays at once. Each ray still gets exactly
+// the hit intersect(ray) would find.
+template<typename Real>
+void Scene::intersect(RayPacket& packet, std::span<const EyeRelativeSphere<Real>> eye) const{
+    const BasicSpherePack<Real>& spheresInLeafOrder = getPack<Real>();
+    bvh.traversePacket(packet, [&](uint32_t first, uint32_t count){
+        spheresInLeafOrder.intersect(packet, first, count, eye);
+    });
+}
+
+template<typename Real>
+std::optional<Intersection> Scene::getIntersection(const RayPacket& packet, uint32_t lane) const{
+    const Hit& hit = packet._hits[lane];
+    if(hit._index == SpherePack::noHit){
+        return {};
+    }
+    const BasicSpherePack<Real>& spheresInLeafOrder = getPack<Real>();
+    return Intersection(packet.getRay(lane), spheresInLeafOrder.getCenter(hit._index), spheresInLeafOrder.getMaterial(hit._index), hit._t, hit._index);
+}
+
+std::optional<Intersection> Scene::intersectLinear(const Ray& ray, uint32_t origin) const{
+
+    std::optional<Hit> result = {};
+
+    // without a pack the spheres are numbered as in spheres
+    for(uint32_t index = 0; index < spheres.size(); ++index){
+
+        double tMax = result.has_value() ? result->_t : std::numeric_limits<double>::infinity();
+        std::optional<double> t = index == origin ? ray.intersectsFromSurface(spheres[index]._center, spheres[index]._radius_squared)
+                                                  : ray.intersects(spheres[index], tMax);
+
+        if( !t.has_value()){
             continue;
         }
-        if(!result.has_value() || i->_t < result->_t){
-            result = i;
+        if(!result.has_value() || *t < result->_t){
+            result = Hit{*t, index};
         }
     }
 
-    return result;
+    if(!result.has_value()){
+        return {};
+    }
+    const Sphere& sphere = spheres[result->_index];
+    return Intersection(ray, sphere._center, materials[sphere._material], result->_t, result->_index);
 }
 
+// Is there anything between the ray origin and tMax? That's all a shadow ray needs to know, so unlike intersect()
+// we don't look for the closest hit: the first shadow casting sphere we find ends the search.
+template<typename Real>
+bool Scene::occluded(const Ray& ray, double tMax, uint32_t origin) const{
+
+    // A shadow ray is only sent towards lights in front of the surface, so it never goes back into the sphere it
+    // starts on. That sphere can simply be skipped
+    if(bvh.empty()){
+        for(uint32_t index = 0; index < spheres.size(); ++index){
+            const Sphere& sphere = spheres[index];
+            std::optional<double> t = ray.intersects(sphere, tMax);
+            if(index != origin && t.has_value() && *t < tMax && materials[sphere._material].isShadowCaster()){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool blocked = false;
+    bvh.traverse(ray, tMax, [&](uint32_t first, uint32_t count){
+        blocked = getPack<Real>().occludes(ray, first, count, tMax, origin);
+        return blocked; // stops the traversal
+    });
+    return blocked;
+}
 
+template<typename Real>
 vec3 Scene::traceRay(const Ray& ray, double IoR, int recDepth) const {
 
     // In Ray-tracing we shoot rays in a scene and they bounce around. How many times we bounce affects the performance
@@ -41,66 +199,115 @@ vec3 Scene::traceRay(const Ray& ray, double IoR, int recDepth) const {
         return vec3(0, 0, 0);
     }
 
-    std::optional<Intersection> intersection = intersect(ray); //this intersection object has 3 elements( _material, _normal & distance(_t) ) now
+    std::optional<Intersection> intersection = intersect<Real>(ray); //this intersection object has 3 elements( _material, _normal & distance(_t) ) now, _material points into our scene
+    return shade<Real>(ray, intersection, IoR, recDepth);
+}
+
+// Everything traceRay does once it knows what the ray hit. Split off so that rays which were intersected some other
+// way (e.g. in a RayPacket) can be shaded with the same code.
+//
+// Every hit can spawn a reflection and a refraction ray, so the rays form a tree. Instead of recursing into both
+// branches we keep a stack of branches still to follow (PathSegment) and add up their colours as we go. The colour of
+// a pixel is local_color * l + reflection * r + refraction * t at every hit, so each branch carries the product of
+// all the r's and t's on its way down as its weight. A branch whose weight is below minPathWeight can't change the
+// pixel visibly any more and is dropped, which bounds the work per pixel for scenes full of glass and mirrors.
+template<typename Real>
+vec3 Scene::shade(const Ray& ray, const std::optional<Intersection>& intersection, double IoR, int recDepth) const {
+
+    // one stack per thread, reused from pixel to pixel so we don't allocate
+    thread_local std::vector<PathSegment> pending;
+    size_t bottom = pending.size();
+
+    vec3 color = shadeHit<Real>(ray, intersection, IoR, recDepth, 1.0, pending);
+    while (pending.size() > bottom) {
+        PathSegment segment = pending.back();
+        pending.pop_back();
+        threadCounters()._secondary++;
+        color += shadeHit<Real>(segment._ray, intersect<Real>(segment._ray, segment._origin), segment._IoR, segment._recDepth, segment._weight, pending);
+    }
+    return color;
+}
+
+// The colour of one hit, scaled by weight, without its reflection and refraction. Those are pushed onto pending.
+template<typename Real>
+vec3 Scene::shadeHit(const Ray& ray, const std::optional<Intersection>& intersection, double IoR, int recDepth, double weight, std::vector<PathSegment>& pending) const {
+
     //Nothing hit, return background colour
     if (!intersection.has_value()) {
-        return backgroundColor;
+        return backgroundColor * weight;
     }
 
     // We hit something. Quick, get the intersection point and the surface normal
     // A normal vector is a vector that is perpendicular to a surface, i.e. it's the up vector even if you twist and turn
     // the surface
-    vec3 intersectionPoint = ray.point_at(intersection->_t - epsilon);
+    // The reflection, refraction and shadow rays all start right here. They pass on which sphere they start on, so
+    // that they don't find this very point again (see intersect), and don't need to be moved off the surface
+    vec3 intersectionPoint = ray.point_at(intersection->_t);
     vec3 normal = intersection->_normal;
 
+    // Reflection and Refraction Weighting:
+    //Determines how much weight to assign to local lighting ( l), reflection ( r), and refraction ( t).
+    //These weights depend on the material's properties (reflectivity and refractivity) and the angle of incidence
+
+    double cosI = dot(ray._direction,intersection->getNormal());
+    double l = 0, r = 0, t = 0;
+
+    if (intersection->getMaterial().refracts()) {
+        l = intersection->getMaterial().getLocalReflectivity();
+        r = intersection->getMaterial().getReflectivity(cosI);
+        t = 1 - r;
+        r = (1 - l) * r;
+        t = (1 - l) * t;
+    } else if (intersection->getMaterial().reflects()) {
+        r = intersection->getMaterial().getReflectivity(cosI);
+        l = 1 - r;
+    } else {
+        l = 1;
+    }
+
+
+
     // Once we hit a surface we may need to send out up to 2 more rays. A reflection ray, for e.g. a mirror, and a
-    // refraction ray for e.g. glass. There are mixtures like partially opaque metallic objects, play around with it
-    vec3 reflection;
-    if(intersection->_material.reflects()) {
-        Ray reflectionRay(intersectionPoint + normal * epsilon, ray._direction.reflection(normal));
-        reflection = traceRay(reflectionRay, IoR, recDepth - 1); // Scene::traceRay generally returns a vec3 color
-    }else {
-        reflection = vec3();
+    // refraction ray for e.g. glass. There are mixtures like partially opaque metallic objects, play around with it.
+    // In Ray-tracing we shoot rays in a scene and they bounce around. How many times we bounce affects the performance
+    // and realism. Once recDepth runs out a ray would return black, so we don't even send it
+    double reflectionWeight = weight * r;
+    if(intersection->getMaterial().reflects() && recDepth > 1 && reflectionWeight >= minPathWeight) {
+        Ray reflectionRay(intersectionPoint, ray._direction.reflection(normal));
+        pending.push_back(PathSegment{reflectionRay, IoR, recDepth - 1, reflectionWeight, intersection->_index});
     }
 
     // The index of refraction (IoR) gives us an indication how much slower light is in a medium in comparison to air.
     // Air usually has an IoR of 1.0, and most materials have an IoR > 1.0. This affects how light is refracted in a medium.
     // Same if you look into a pond and see a fish a couple inches away from where it ought to be
-    vec3 refraction;
-    if(intersection->_material.refracts()) {
+    double refractionWeight = weight * t;
+    if(intersection->getMaterial().refracts() && recDepth > 1 && refractionWeight >= minPathWeight) {
         // total internal refraction may occur, i.e. the ray is lost in that medium. It's just a thing that can happen in light physics
 
-        std::optional<vec3> refractionDir = ray._direction.refraction(normal, intersection->_material.getIndexOfRefraction()); //returns a vec3
+        std::optional<vec3> refractionDir = ray._direction.refraction(normal, intersection->getMaterial().getIndexOfRefraction()); //returns a vec3
         if(refractionDir.has_value()) { // i.e. our refraction is not total internal refraction
 
             // We need to check whether we're in the air or the medium.
 
             if(IoR == 1.0) //air has IoR of 1, so this condition applies when Ray is still in Air, and now it will enter the medium
             {
-                 double nextIoR = intersection->getMaterial().getIndexOfRefraction();
-                // A little epsilon offset into the object, our new starting location for the ray
-                // Shoot a ray (traceRay) and see where it hits the inner surface on the other side
-                //let's not forget to reduce the recursion depth. Orient on the reflection ray how to call the traceRay method
-
-                 // Start slightly inside the medium when entering the medium (if condition segment) to avoid self-intersection
-                // Start slightly outside the surface of the medium when exiting (our else condition segment) to avoid self-intersection
-
-               Ray refractionRay(intersectionPoint - normal * epsilon, refractionDir.value());
-                refraction = traceRay(refractionRay, nextIoR, recDepth - 1);
+                double nextIoR = intersection->getMaterial().getIndexOfRefraction();
+                Ray refractionRay(intersectionPoint, refractionDir.value());
+                pending.push_back(PathSegment{refractionRay, nextIoR, recDepth - 1, refractionWeight, intersection->_index});
             }
             else //When Ray exits the sphere medium and Ray goes back to Air medium
             {
-                double nextIoR = 1.0; //we set the nextIoR value back to 1 for our next function call
-
-                Ray refractionRay(intersectionPoint + normal * epsilon, refractionDir.value());
-                refraction = traceRay(refractionRay, nextIoR, recDepth - 1);
+                double nextIoR = 1.0; //we set the nextIoR value back to 1 for the next segment
+                Ray refractionRay(intersectionPoint, refractionDir.value());
+                pending.push_back(PathSegment{refractionRay, nextIoR, recDepth - 1, refractionWeight, intersection->_index});
             }
-
-
-
         }
     }
 
+    if (l == 0) {
+        return vec3(); // nothing local to see, no need for the lighting below (and its shadow rays)
+    }
+
     /* We use the Phong lighting model (not to be confused with Phong shading). Ambient + Diffuse + Specular gives us the
      * local colour. Ambient is the always present colour of an object, diffuse is the light-orientation dependent colour
      * of an object. Specular is the shiny highlight on top of an object. That's a simple illumination model and we
@@ -114,25 +321,40 @@ vec3 Scene::traceRay(const Ray& ray, double IoR, int recDepth) const {
         Models highlights (shininess) by raising the reflection intensity ( val) to the power of the material's specular exponent.
 
      * For diffuse, we multiply the diffuse colour of an object with a factor. That factor is the dot product between
-     * the up vector and the surface normal ( technically both should be inverted, as we want to check the light direction
-     * against the surface orientation.
+     * the direction towards the light and the surface normal. We do that once per light in the scene, and only for the
+     * lights the point can actually see: a shadow ray towards the light tells us whether something is in the way.
      *
 
      */
 
+    vec3 diffuse;
+    vec3 specular;
+    for(const Light& light : lights) {
+        double distance;
+        vec3 toLight = light.getDirectionFrom(intersectionPoint, distance);
+        double cosL = dot(toLight, normal);
+        if(cosL <= 0) {
+            continue; // the light is behind the surface, it can't light it up. No need for a shadow ray either
+        }
+        // only whether something blocks the light matters, not what it is, so occluded() can stop at the first hit
+        threadCounters()._shadow++;
+        if(occluded<Real>(Ray(intersectionPoint, toLight), distance, intersection->_index)) {
+            continue;
+        }
 
-    vec3 diffuse = intersection->_material.getDiffuse() * dot(vec3(0.0,1.0,0.0),normal);
-    double val = dot(vec3(0.0,1.0,0.0), ray._direction.reflection(normal));
-    if(val < 0) {
+        diffuse += intersection->getMaterial().getDiffuse() * light.getColor() * cosL;
+        double val = dot(toLight, ray._direction.reflection(normal));
+        if(val < 0) {
 
-        val = 0; // //Q.what happens if you remove this line. A: all the reflections of spheres inside the spheres also show reflective properties
-    }
+            val = 0; // //Q.what happens if you remove this line. A: all the reflections of spheres inside the spheres also show reflective properties
+        }
 
-    // specular is somewhat of a hack. (tbh in phong lighting everything is a hack but it looks good right?)
-    // We take val ^ exponent which is between 0 and 1. We multiply that with the specular colour of the material.
-    // Result? The higher the exponent, the smaller the bright shiny surface. If you want rougher surfaces, lower exponent.
-    // Shinier surfaces -> higher exponent
-    vec3 specular = intersection->_material.getSpecular() * pow(val, intersection->_material.getExponent());
+        // specular is somewhat of a hack. (tbh in phong lighting everything is a hack but it looks good right?)
+        // We take val ^ exponent which is between 0 and 1. We multiply that with the specular colour of the material.
+        // Result? The higher the exponent, the smaller the bright shiny surface. If you want rougher surfaces, lower exponent.
+        // Shinier surfaces -> higher exponent
+        specular += intersection->getMaterial().getSpecular() * light.getColor() * pow(val, intersection->getMaterial().getExponent());
+    }
 
 
     /*
@@ -141,35 +363,36 @@ vec3 Scene::traceRay(const Ray& ray, double IoR, int recDepth) const {
      */
 
     // The local_color is the ambient colour (we multiply it with 1/2) + diffuse colour + specular colour
-    vec3 local_color = intersection->_material.getAmbient() * vec3(0.5,0.5,0.5) + diffuse + specular;
+    vec3 local_color = intersection->getMaterial().getAmbient() * vec3(0.5,0.5,0.5) + diffuse + specular;
 
     local_color.clamp(0.0,1.0);
 
 
-    // Reflection and Refraction Weighting:
-    //Determines how much weight to assign to local lighting ( l), reflection ( r), and refraction ( t).
-    //These weights depend on the material's properties (reflectivity and refractivity) and the angle of incidence
-
-    double cosI = dot(ray._direction,intersection->getNormal());
-    double l = 0, r = 0, t = 0;
-
-    if (intersection->getMaterial().refracts()) {
-        l = intersection->getMaterial().getLocalReflectivity();
-        r = intersection->getMaterial().getReflectivity(cosI);
-        t = 1 - r;
-        r = (1 - l) * r;
-        t = (1 - l) * t;
-    } else if (intersection->getMaterial().reflects()) {
-        r = intersection->getMaterial().getReflectivity(cosI);
-        l = 1 - r;
-    } else {
-        l = 1;
-    }
-
 
-    //return local_color * l; //TRY OUT ONE OF THE OTHER OPTIONS
-   // return local_color * l +  reflection * r;
-  // return local_color * l + refraction * t;
+    // local_color * l is this hit's share of  local_color * l + reflection * r + refraction * t, the other two
+    // parts are added when their segments are taken off the stack
+    return local_color * (l * weight);
+}
 
-    return local_color * l +  reflection * r + refraction * t; //IF REFLECTIONS AND REFRACTIONS WORK
-}
\ No newline at end of file
+// the two precisions there are, see Scene.hpp
+template void Scene::build<double>();
+template bool Scene::isBuilt<double>() const;
+template const BasicSpherePack<double>& Scene::getPack<double>() const;
+template std::optional<Intersection> Scene::intersect<double>(const Ray&, uint32_t) const;
+template void Scene::intersect<double>(RayPacket&, std::span<const EyeRelativeSphere<double>>) const;
+template std::optional<Intersection> Scene::getIntersection<double>(const RayPacket&, uint32_t) const;
+template bool Scene::occluded<double>(const Ray&, double, uint32_t) const;
+template vec3 Scene::traceRay<double>(const Ray&, double, int) const;
+template vec3 Scene::shade<double>(const Ray&, const std::optional<Intersection>&, double, int) const;
+template vec3 Scene::shadeHit<double>(const Ray&, const std::optional<Intersection>&, double, int, double, std::vector<PathSegment>&) const;
+
+template void Scene::build<float>();
+template bool Scene::isBuilt<float>() const;
+template const BasicSpherePack<float>& Scene::getPack<float>() const;
+template std::optional<Intersection> Scene::intersect<float>(const Ray&, uint32_t) const;
+template void Scene::intersect<float>(RayPacket&, std::span<const EyeRelativeSphere<float>>) const;
+template std::optional<Intersection> Scene::getIntersection<float>(const RayPacket&, uint32_t) const;
+template bool Scene::occluded<float>(const Ray&, double, uint32_t) const;
+template vec3 Scene::traceRay<float>(const Ray&, double, int) const;
+template vec3 Scene::shade<float>(const Ray&, const std::optional<Intersection>&, double, int) const;
+template vec3 Scene::shadeHit<float>(const Ray&, const std::optional<Intersection>&, double, int, double, std::vector<PathSegment>&) const;
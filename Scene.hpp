@@ -7,18 +7,88 @@
 #include "Sphere.hpp"
 #include "Intersection.hpp"
 #include "Ray.hpp"
+#include "BVH.hpp"
+#include "SpherePack.hpp"
+#include "Light.hpp"
+#include "RayPacket.hpp"
+#include <memory>
 #include <vector>
 
+class MappedFile;
+
+// A reflection or refraction ray that still has to be traced, see Scene::shade
+struct PathSegment {
+    Ray _ray;
+    double _IoR;
+    int _recDepth;
+    double _weight; // how much this ray's colour counts towards the pixel
+    uint32_t _origin; // the sphere the ray starts on, see Scene::intersect
+};
+
+// How many rays of each kind were traced. Scene counts per thread (see Scene::threadCounters), whoever renders adds
+// the numbers of all threads up
+struct RayCounters {
+    uint64_t _primary = 0;
+    uint64_t _secondary = 0; // reflection and refraction rays
+    uint64_t _shadow = 0;
+
+    RayCounters& operator+=(const RayCounters& other);
+    RayCounters operator-(const RayCounters& other) const;
+};
+
 struct Scene{
     std::vector<Sphere> spheres;
+    std::vector<Material> materials; // the spheres refer to these by index, see addMaterial
+    BVH bvh; // built by build(), cleared whenever the spheres change
+    SpherePack pack; // the spheres again, in the leaf order of the BVH and laid out for the SIMD intersection test
+    SpherePackF packF; // pack in float, for rendering in float (see build). Empty until build<float>()
+    std::vector<Light> lights;
+    // set if the BVH and the pack live in a mapped scene cache (see SceneCache.hpp), keeps the mapping alive as
+    // long as any copy of the scene uses it. spheres is empty then
+    std::shared_ptr<const MappedFile> cache;
     vec3 backgroundColor;
-    double epsilon = 0.0000000001;
+    double minPathWeight = 1.0 / 1024; // reflection/refraction rays that count less than this are not traced
     explicit Scene(vec3 backgroundColor):backgroundColor(backgroundColor){}
     Scene():backgroundColor(vec3(0,0,0)){}
-    void addSphere(Sphere object);
+    MaterialIndex addMaterial(Material material); // the index to give the spheres with this material
+    void addSphere(Sphere object); // object._material has to be an index returned by addMaterial
+    void addLight(Light light);
     const vec3 getBackgroundColor() const;
-    std::optional<Intersection> intersect(const Ray& ray) const;
+    // Builds the BVH and the pack, unless they are already built. build<float>() also builds packF.
+    //
+    // The Real template parameter of build, intersect, occluded, traceRay, shade and shadeHit picks the precision
+    // the intersection tests run in. double is the reference. float stores and tests the spheres in float (half
+    // the memory traffic, twice the SIMD lanes) while the BVH, the shading and all colours stay in double; only
+    // the distances to the hits lose precision, so the image differs from the double one in a few pixels along
+    // edges and in reflections. Real = float needs build<float>() first
+    template<typename Real = double>
+    void build();
+    template<typename Real = double>
+    bool isBuilt() const; // true if build<Real>() has nothing left to do
+    uint64_t sphereCount() const;
+    template<typename Real = double>
+    const BasicSpherePack<Real>& getPack() const; // pack or packF
+    // The closest hit along the ray. origin is the sphere a reflected or refracted ray starts on (the _index of
+    // the Intersection it comes from), or noHit. That sphere is never hit right at the start, wherever the rounding
+    // put the ray origin, and so secondary rays start exactly at the hit point instead of some epsilon off it
+    template<typename Real = double>
+    std::optional<Intersection> intersect(const Ray& ray, uint32_t origin = SpherePack::noHit) const;
+    std::optional<Intersection> intersectLinear(const Ray& ray, uint32_t origin = SpherePack::noHit) const;
+    // needs build(), fills packet._hits. eye: empty or getPack<Real>().eyeRelative(packet._origin, ...), which
+    // primary rays share for a whole frame
+    template<typename Real = double>
+    void intersect(RayPacket& packet, std::span<const EyeRelativeSphere<Real>> eye = {}) const;
+    template<typename Real = double>
+    std::optional<Intersection> getIntersection(const RayPacket& packet, uint32_t lane) const;
+    template<typename Real = double>
+    bool occluded(const Ray& ray, double tMax, uint32_t origin = SpherePack::noHit) const; // origin as in intersect
+    static RayCounters& threadCounters(); // the calling thread's counters, they only ever grow
+    template<typename Real = double>
     vec3 traceRay(const Ray& ray, double IoR, int recDepth) const;
+    template<typename Real = double>
+    vec3 shade(const Ray& ray, const std::optional<Intersection>& intersection, double IoR, int recDepth) const;
+    template<typename Real = double>
+    vec3 shadeHit(const Ray& ray, const std::optional<Intersection>& intersection, double IoR, int recDepth, double weight, std::vector<PathSegment>& pending) const;
 };
 
 #endif //SCENE_HPP
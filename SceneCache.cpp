@@ -0,0 +1,256 @@
+
+
+#include "SceneCache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+namespace {
+    constexpr char cacheMagic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    // bump this whenever the layout of the file or of one of the stored structs changes
+    constexpr uint32_t cacheVersion = 3;
+    constexpr uint32_t byteOrderMark = 0x01020304; // reads differently if the file was written with the other byte order
+    constexpr uint64_t sectionAlignment = 64;
+
+    // the arrays are written and read as raw bytes
+    static_assert(std::is_trivially_copyable_v<BVHNode>, "BVH nodes are stored as they are in memory");
+    static_assert(std::is_trivially_copyable_v<Material>, "materials are stored as they are in memory");
+    static_assert(std::is_trivially_copyable_v<Light>, "lights are stored as they are in memory");
+
+    enum Section { Lights, Nodes, Indices, CenterX, CenterY, CenterZ, RadiusSquared, SphereIndices, MaterialIndices, Materials, SectionCount };
+
+    struct SectionEntry {
+        uint64_t _offset; // from the start of the file, a multiple of sectionAlignment
+        uint64_t _count;  // elements, not bytes
+    };
+
+    struct CacheHeader {
+        char _magic[8];
+        uint32_t _version;
+        uint32_t _byteOrder;
+        uint32_t _nodeSize;     // sizeof(BVHNode) etc. of the program that wrote the file
+        uint32_t _materialSize;
+        uint32_t _lightSize;
+        int32_t _recDepth;
+        uint64_t _width;
+        uint64_t _height;
+        double _eyePoint[3];
+        double _viewDir[3];
+        double _upDir[3];
+        double _fieldOfView;
+        double _backgroundColor[3];
+        double _minPathWeight;
+        SectionEntry _sections[SectionCount];
+    };
+
+    template<typename T>
+    std::span<const T> sectionSpan(const unsigned char* file, const SectionEntry& section) {
+        return std::span<const T>(reinterpret_cast<const T*>(file + section._offset), section._count);
+    }
+
+    void storeVector(double (&target)[3], const vec3& v) {
+        for (int i = 0; i < 3; ++i) {
+            target[i] = v[i];
+        }
+    }
+
+    vec3 loadVector(const double (&source)[3]) {
+        return vec3(source[0], source[1], source[2]);
+    }
+
+    // The BVH and the pack index into each other and into their own arrays without any checks, so a damaged file
+    // would have them read anywhere. One pass over everything that is an index makes sure they stay inside:
+    // the children of a node come after it (no cycles) and aren't nested deeper than BVH::traverse has stack for,
+    // leaves cover spheres of the pack, and sphere and material indices point at spheres and materials there are
+    bool indicesValid(std::span<const BVHNode> nodes, std::span<const uint32_t> indices, std::span<const uint32_t> sphereIndices,
+                      std::span<const uint32_t> materialIndices, uint64_t materialCount) {
+        uint64_t sphereCount = sphereIndices.size();
+        std::vector<uint32_t> depth(nodes.size(), 0); // longest path from the root, final once we get to the node
+        for (uint64_t i = 0; i < nodes.size(); ++i) {
+            const BVHNode& node = nodes[i];
+            if (node.isLeaf()) {
+                if ((uint64_t) node._offset + node._count > sphereCount) {
+                    return false;
+                }
+                continue;
+            }
+            if (node._axis > 2 || node._offset <= i + 1 || node._offset >= nodes.size() || depth[i] + 1 >= BVH::stackCapacity) {
+                return false;
+            }
+            for (uint64_t child : {i + 1, (uint64_t) node._offset}) {
+                depth[child] = std::max(depth[child], depth[i] + 1);
+            }
+        }
+        for (std::span<const uint32_t> sphere : {indices, sphereIndices}) {
+            if (std::any_of(sphere.begin(), sphere.end(), [&](uint32_t index) { return index >= sphereCount; })) {
+                return false;
+            }
+        }
+        return std::all_of(materialIndices.begin(), materialIndices.end(), [&](uint32_t index) { return index < materialCount; });
+    }
+}
+
+bool isSceneCache(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(cacheMagic)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, cacheMagic, sizeof(magic)) == 0;
+}
+
+bool saveSceneCache(const SceneDescription& description, const char* filename, std::string& error) {
+    const Scene& scene = description._scene;
+    if (scene.bvh.empty()) {
+        error = "the scene has to be built before it can be cached";
+        return false;
+    }
+
+    CacheHeader header = {};
+    std::memcpy(header._magic, cacheMagic, sizeof(cacheMagic));
+    header._version = cacheVersion;
+    header._byteOrder = byteOrderMark;
+    header._nodeSize = sizeof(BVHNode);
+    header._materialSize = sizeof(Material);
+    header._lightSize = sizeof(Light);
+    header._recDepth = description._recDepth;
+    header._width = description._width;
+    header._height = description._height;
+    storeVector(header._eyePoint, description._camera.getEyePoint());
+    storeVector(header._viewDir, description._camera.getViewDir());
+    storeVector(header._upDir, description._camera.getUpDir());
+    header._fieldOfView = description._camera.getFoV();
+    storeVector(header._backgroundColor, scene.getBackgroundColor());
+    header._minPathWeight = scene.minPathWeight;
+
+    // every section as (bytes, element count), in the order of the Section enum
+    struct Bytes {
+        const void* _data;
+        uint64_t _count;
+        uint64_t _elementSize;
+    };
+    SpherePack::Arrays arrays = scene.pack.getArrays();
+    std::span<const BVHNode> nodes = scene.bvh.getNodes();
+    std::span<const uint32_t> indices = scene.bvh.getIndices();
+    Bytes contents[SectionCount] = {
+        {scene.lights.data(), scene.lights.size(), sizeof(Light)},
+        {nodes.data(), nodes.size(), sizeof(BVHNode)},
+        {indices.data(), indices.size(), sizeof(uint32_t)},
+        {arrays._centerX.data(), arrays._centerX.size(), sizeof(double)},
+        {arrays._centerY.data(), arrays._centerY.size(), sizeof(double)},
+        {arrays._centerZ.data(), arrays._centerZ.size(), sizeof(double)},
+        {arrays._radiusSquared.data(), arrays._radiusSquared.size(), sizeof(double)},
+        {arrays._sphereIndex.data(), arrays._sphereIndex.size(), sizeof(uint32_t)},
+        {arrays._materialIndex.data(), arrays._materialIndex.size(), sizeof(uint32_t)},
+        {arrays._materials.data(), arrays._materials.size(), sizeof(Material)},
+    };
+    uint64_t offset = sizeof(CacheHeader);
+    for (int i = 0; i < SectionCount; ++i) {
+        offset = (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+        header._sections[i] = SectionEntry{offset, contents[i]._count};
+        offset += contents[i]._count * contents[i]._elementSize;
+    }
+
+    std::vector<unsigned char> file(offset, 0);
+    std::memcpy(file.data(), &header, sizeof(header));
+    for (int i = 0; i < SectionCount; ++i) {
+        if (contents[i]._count > 0) {
+            std::memcpy(file.data() + header._sections[i]._offset, contents[i]._data, contents[i]._count * contents[i]._elementSize);
+        }
+    }
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(file.data()), (std::streamsize) file.size());
+    if (!out.good()) {
+        error = std::string("can't write ") + filename;
+        return false;
+    }
+    return true;
+}
+
+std::optional<SceneDescription> loadSceneCache(const char* filename, std::string& error, bool checkIndices) {
+    std::optional<MappedFile> mapping = MappedFile::open(filename);
+    if (!mapping) {
+        error = std::string("can't map ") + filename;
+        return {};
+    }
+    const unsigned char* file = static_cast<const unsigned char*>(mapping->data());
+    uint64_t fileSize = mapping->size();
+    CacheHeader header;
+    if (fileSize < sizeof(header)) {
+        error = std::string(filename) + " is too short for a scene cache";
+        return {};
+    }
+    std::memcpy(&header, file, sizeof(header));
+    if (std::memcmp(header._magic, cacheMagic, sizeof(cacheMagic)) != 0) {
+        error = std::string(filename) + " is not a scene cache";
+        return {};
+    }
+    if (header._version != cacheVersion || header._byteOrder != byteOrderMark || header._nodeSize != sizeof(BVHNode)
+        || header._materialSize != sizeof(Material) || header._lightSize != sizeof(Light)) {
+        error = std::string(filename) + " was written by a different version or build, load the scene file instead";
+        return {};
+    }
+    const uint64_t elementSizes[SectionCount] = {sizeof(Light), sizeof(BVHNode), sizeof(uint32_t), sizeof(double),
+                                                 sizeof(double), sizeof(double), sizeof(double), sizeof(uint32_t),
+                                                 sizeof(uint32_t), sizeof(Material)};
+    for (int i = 0; i < SectionCount; ++i) {
+        const SectionEntry& section = header._sections[i];
+        if (section._offset % sectionAlignment != 0 || section._offset > fileSize
+            || section._count > (fileSize - section._offset) / elementSizes[i]) {
+            error = std::string(filename) + " is damaged (section " + std::to_string(i) + " is out of bounds)";
+            return {};
+        }
+    }
+    // the pack has one entry per sphere, plus the padding on the coordinate arrays
+    uint64_t sphereCount = header._sections[SphereIndices]._count;
+    bool consistent = header._sections[Indices]._count == sphereCount
+        && header._sections[MaterialIndices]._count == sphereCount
+        && header._sections[Materials]._count > 0
+        && header._sections[Nodes]._count > 0;
+    for (int i = CenterX; i <= RadiusSquared; ++i) {
+        consistent = consistent && header._sections[i]._count == sphereCount + SpherePack::padding;
+    }
+    if (!consistent || sphereCount == 0) {
+        error = std::string(filename) + " is damaged (the array sizes don't fit together)";
+        return {};
+    }
+
+    std::span<const BVHNode> nodes = sectionSpan<BVHNode>(file, header._sections[Nodes]);
+    std::span<const uint32_t> indices = sectionSpan<uint32_t>(file, header._sections[Indices]);
+    if (checkIndices && !indicesValid(nodes, indices, sectionSpan<uint32_t>(file, header._sections[SphereIndices]),
+                      sectionSpan<uint32_t>(file, header._sections[MaterialIndices]), header._sections[Materials]._count)) {
+        error = std::string(filename) + " is damaged (an index points outside its array)";
+        return {};
+    }
+
+    SceneDescription description;
+    Scene& scene = description._scene;
+    scene.backgroundColor = loadVector(header._backgroundColor);
+    scene.minPathWeight = header._minPathWeight;
+    std::span<const Light> lights = sectionSpan<Light>(file, header._sections[Lights]);
+    scene.lights.assign(lights.begin(), lights.end());
+    std::span<const Material> materials = sectionSpan<Material>(file, header._sections[Materials]);
+    scene.materials.assign(materials.begin(), materials.end()); // only a handful, the pack uses the mapped ones
+    scene.bvh.view(nodes, indices);
+    scene.pack.view(SpherePack::Arrays{
+        sectionSpan<double>(file, header._sections[CenterX]),
+        sectionSpan<double>(file, header._sections[CenterY]),
+        sectionSpan<double>(file, header._sections[CenterZ]),
+        sectionSpan<double>(file, header._sections[RadiusSquared]),
+        sectionSpan<uint32_t>(file, header._sections[SphereIndices]),
+        sectionSpan<uint32_t>(file, header._sections[MaterialIndices]),
+        sectionSpan<Material>(file, header._sections[Materials]),
+    });
+    // the BVH and the pack point into the mapping, so it has to live as long as the scene and all its copies
+    scene.cache = std::make_shared<const MappedFile>(std::move(*mapping));
+    description._camera = Camera(loadVector(header._eyePoint), loadVector(header._viewDir), loadVector(header._upDir), header._fieldOfView);
+    description._recDepth = header._recDepth;
+    description._width = header._width;
+    description._height = header._height;
+    return description;
+}
@@ -0,0 +1,36 @@
+
+
+#ifndef SCENECACHE_HPP
+#define SCENECACHE_HPP
+
+#include <optional>
+#include <string>
+
+#include "SceneFile.hpp"
+
+// A scene cache is a binary snapshot of a built scene: the camera and settings, the lights, the BVH nodes and the
+// sphere pack arrays exactly as they are in memory, each array starting at a 64 byte boundary. Loading one maps the
+// file and points the BVH and the pack straight at the mapped arrays, nothing is parsed, copied or built. So the
+// startup time hardly depends on the size of the scene, the pages are read from disk when the first rays touch them.
+//
+// The arrays are stored in the native layout and byte order, so a cache only works on the kind of machine (and with
+// the build of the program) that wrote it. The header has a version number and the sizes of the stored structs;
+// loading refuses files that don't match and the scene has to be loaded from its text file again.
+// Damaged files are refused too as far as that can be told without reading the arrays: every array has to lie inside
+// the file. Whether every index in them (BVH children and leaves, sphere and material indices) points inside the
+// array it is for is only checked on request, as that means reading the whole file: linear in the size of the scene,
+// a few dozen milliseconds for millions of spheres. A file with broken indices that isn't checked crashes the renderer.
+//
+// A scene loaded from a cache has no Scene::spheres, only the BVH and the pack. It renders just like the original,
+// but can't be changed: adding a sphere would throw away the BVH.
+
+// true if the file starts like a scene cache (it may still be a version we can't load)
+bool isSceneCache(const char* filename);
+// writes the scene, which has to be built (Scene::build), and its settings to filename. false with error set if
+// that doesn't work
+bool saveSceneCache(const SceneDescription& description, const char* filename, std::string& error);
+// maps the file, nothing if it can't be read or doesn't fit this program, error then says why. checkIndices also
+// refuses files with indices that point outside their arrays, see above
+std::optional<SceneDescription> loadSceneCache(const char* filename, std::string& error, bool checkIndices = false);
+
+#endif //SCENECACHE_HPP
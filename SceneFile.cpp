@@ -0,0 +1,273 @@
+
+
+#include "SceneFile.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Light.hpp"
+#include "Material.hpp"
+#include "Sphere.hpp"
+
+namespace {
+    const size_t chunkSize = 1 << 20;
+    const size_t maxTokens = 16;
+    // "sphere" and five arguments of at least one character, each after a space
+    const uint64_t shortestSphereLine = 16;
+
+    // the words of one line, pointing into the read buffer
+    struct Line {
+        std::string_view _tokens[maxTokens];
+        size_t _count = 0;
+    };
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    void tokenize(std::string_view text, Line& line) {
+        line._count = 0;
+        size_t i = 0;
+        while (i < text.size() && line._count < maxTokens) {
+            while (i < text.size() && isSpace(text[i])) {
+                ++i;
+            }
+            if (i == text.size() || text[i] == '#') {
+                return;
+            }
+            size_t start = i;
+            while (i < text.size() && !isSpace(text[i])) {
+                ++i;
+            }
+            line._tokens[line._count++] = text.substr(start, i - start);
+        }
+    }
+
+    template<typename T>
+    bool parse(std::string_view token, T& value) {
+        auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+        return result.ec == std::errc() && result.ptr == token.data() + token.size();
+    }
+
+    // lets the material table be searched with a string_view, without making a std::string for every sphere
+    struct NameHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+    };
+
+    class SceneParser {
+        SceneDescription& _description;
+        std::unordered_map<std::string, MaterialIndex, NameHash, std::equal_to<>> _materials; // name -> Scene::materials
+        const Line* _line = nullptr;
+        std::string _error;
+        uint64_t _maxSpheres; // more than this many sphere lines don't fit into the file
+
+        bool fail(const std::string& message) {
+            _error = message;
+            return false;
+        }
+
+        bool number(size_t index, double& value) {
+            if (index >= _line->_count || !parse(_line->_tokens[index], value)) {
+                return fail("expected a number as argument " + std::to_string(index));
+            }
+            return true;
+        }
+
+        bool vector(size_t index, vec3& value) {
+            return number(index, value[0]) && number(index + 1, value[1]) && number(index + 2, value[2]);
+        }
+
+        bool arguments(size_t min, size_t max) {
+            if (_line->_count < min + 1 || _line->_count > max + 1) {
+                return fail("'" + std::string(_line->_tokens[0]) + "' takes " + std::to_string(min) +
+                            (min == max ? "" : " to " + std::to_string(max)) + " arguments");
+            }
+            return true;
+        }
+
+        bool sphere() {
+            double radius;
+            vec3 center;
+            if (!arguments(5, 5) || !number(1, radius) || !vector(2, center)) {
+                return false;
+            }
+            auto material = _materials.find(_line->_tokens[5]);
+            if (material == _materials.end()) {
+                return fail("unknown material '" + std::string(_line->_tokens[5]) + "'");
+            }
+            _description._scene.addSphere(Sphere(radius, center, material->second));
+            return true;
+        }
+
+        bool material() {
+            vec3 ambient, diffuse, specular;
+            double exponent, local = 1, ior = 0;
+            if (!arguments(11, 13) || !vector(2, ambient) || !vector(5, diffuse) || !vector(8, specular) || !number(11, exponent)) {
+                return false;
+            }
+            if ((_line->_count > 12 && !number(12, local)) || (_line->_count > 13 && !number(13, ior))) {
+                return false;
+            }
+            // a redefined name gets a new entry, spheres further up keep the material they had
+            MaterialIndex index = _description._scene.addMaterial(Material(ambient, diffuse, specular, exponent, local, ior));
+            _materials.insert_or_assign(std::string(_line->_tokens[1]), index);
+            return true;
+        }
+
+        bool light() {
+            vec3 where, color;
+            if (!arguments(7, 7) || !vector(2, where) || !vector(5, color)) {
+                return false;
+            }
+            if (_line->_tokens[1] == "directional") {
+                _description._scene.addLight(Light::Directional(where, color));
+            } else if (_line->_tokens[1] == "point") {
+                _description._scene.addLight(Light::Point(where, color));
+            } else {
+                return fail("lights are 'directional' or 'point'");
+            }
+            return true;
+        }
+
+        bool camera() {
+            vec3 eye, lookAt;
+            double fov = 60;
+            if (!arguments(6, 7) || !vector(1, eye) || !vector(4, lookAt) || (_line->_count > 7 && !number(7, fov))) {
+                return false;
+            }
+            _description._camera.setEyePoint(eye);
+            _description._camera.setLookAt(lookAt);
+            _description._camera.setFoV(fov);
+            return true;
+        }
+
+        bool count(size_t index, uint64_t& value) {
+            if (!parse(_line->_tokens[index], value)) {
+                return fail("expected a whole number as argument " + std::to_string(index));
+            }
+            return true;
+        }
+    public:
+        SceneParser(SceneDescription& description, uint64_t fileSize)
+            : _description(description), _maxSpheres(fileSize / shortestSphereLine) {}
+
+        const std::string& getError() const {
+            return _error;
+        }
+
+        bool parseLine(const Line& line) {
+            _line = &line;
+            if (line._count == 0) {
+                return true;
+            }
+            std::string_view keyword = line._tokens[0];
+            // the spheres come first, there are a million of them and only a handful of everything else
+            if (keyword == "sphere") {
+                return sphere();
+            } else if (keyword == "material") {
+                return material();
+            } else if (keyword == "light") {
+                return light();
+            } else if (keyword == "camera") {
+                return camera();
+            } else if (keyword == "background") {
+                return arguments(3, 3) && vector(1, _description._scene.backgroundColor);
+            } else if (keyword == "depth") {
+                uint64_t depth;
+                if (!arguments(1, 1) || !count(1, depth)) {
+                    return false;
+                }
+                if (depth > (uint64_t) std::numeric_limits<int>::max()) {
+                    return fail("the depth can be at most " + std::to_string(std::numeric_limits<int>::max()));
+                }
+                _description._recDepth = (int) depth;
+                return true;
+            } else if (keyword == "image") {
+                return arguments(2, 2) && count(1, _description._width) && count(2, _description._height);
+            } else if (keyword == "spheres") {
+                uint64_t expected;
+                if (!arguments(1, 1) || !count(1, expected)) {
+                    return false;
+                }
+                // only a hint: a count the file can't hold would just allocate (or fail to allocate) memory for nothing
+                _description._scene.spheres.reserve(_description._scene.spheres.size() + std::min(expected, _maxSpheres));
+                return true;
+            }
+            return fail("unknown statement '" + std::string(keyword) + "'");
+        }
+    };
+}
+
+std::optional<SceneDescription> loadSceneFile(const char* filename, std::string& error) {
+    std::FILE* file = std::fopen(filename, "rb");
+    if (!file) {
+        error = std::string("can't open ") + filename;
+        return {};
+    }
+    // how big the file is bounds how many spheres it can have. 0 if it can't be told, e.g. for a pipe
+    uint64_t fileSize = 0;
+    if (std::fseek(file, 0, SEEK_END) == 0) {
+        long size = std::ftell(file);
+        fileSize = size > 0 ? (uint64_t) size : 0;
+        std::fseek(file, 0, SEEK_SET);
+    }
+    SceneDescription description;
+    SceneParser parser(description, fileSize);
+    Line line;
+    uint64_t lineNumber = 0;
+    // The file is read chunk by chunk. The lines are parsed right in the buffer, only an unfinished line at the end
+    // of a chunk is moved to the front before the next chunk is appended to it
+    std::vector<char> buffer(chunkSize);
+    size_t filled = 0;
+    bool ok = true;
+    bool atEnd = false;
+    while (ok && !atEnd) {
+        if (filled == buffer.size()) {
+            buffer.resize(buffer.size() * 2); // a single line longer than the buffer, only happens with broken files
+        }
+        size_t read = std::fread(buffer.data() + filled, 1, buffer.size() - filled, file);
+        filled += read;
+        atEnd = read == 0;
+        std::string_view text(buffer.data(), filled);
+        size_t start = 0;
+        while (ok) {
+            size_t end = text.find('\n', start);
+            if (end == std::string_view::npos) {
+                if (!atEnd) {
+                    break;
+                }
+                if (start >= text.size()) {
+                    break;
+                }
+                end = text.size(); // the last line doesn't need a newline
+            }
+            ++lineNumber;
+            tokenize(text.substr(start, end - start), line);
+            ok = parser.parseLine(line);
+            start = end + 1;
+        }
+        if (start < filled) {
+            std::copy(buffer.begin() + (long) start, buffer.begin() + (long) filled, buffer.begin());
+            filled -= start;
+        } else {
+            filled = 0;
+        }
+    }
+    bool readError = std::ferror(file) != 0;
+    std::fclose(file);
+    if (!ok) {
+        error = std::string(filename) + ":" + std::to_string(lineNumber) + ": " + parser.getError();
+        return {};
+    }
+    if (readError) {
+        error = std::string("can't read ") + filename;
+        return {};
+    }
+    return description;
+}
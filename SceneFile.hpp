@@ -0,0 +1,41 @@
+
+
+#ifndef SCENEFILE_HPP
+#define SCENEFILE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "Camera.hpp"
+#include "Scene.hpp"
+
+// Everything a scene file describes: the scene itself plus how to look at it
+struct SceneDescription {
+    Scene _scene;
+    Camera _camera;
+    int _recDepth = 9;
+    uint64_t _width = 0;  // 0 if the file doesn't say
+    uint64_t _height = 0;
+};
+
+// Scene files are plain text, one statement per line, # starts a comment:
+//
+//   image 2560 1600                          width and height of the picture
+//   depth 9                                  recursion depth
+//   camera 0 1 -5  0 0 0  [60]               eye point, look at point, optionally the field of view
+//   background 0 0 0
+//   material red  1 0 0  1 0 0  1 1 1  8  [0.8 [1.52]]
+//                                            name, ambient, diffuse, specular, exponent, optionally the local
+//                                            reflectivity and the index of refraction (like the Material constructors)
+//   light directional 0 -1 0  1 1 1          direction, color
+//   light point 0 8 -2  1 1 1                position, color
+//   spheres 1000000                          how many spheres follow. Optional, but lets the loader reserve memory
+//                                            once instead of growing the sphere array as it goes
+//   sphere 0.5  2 -1 2.5  red                radius, center, material (defined further up)
+//
+// The file is read in large chunks and parsed in place, so even files with millions of spheres load at about the
+// speed of the disk. Returns nothing if the file can't be read or has errors, error then says what and where.
+std::optional<SceneDescription> loadSceneFile(const char* filename, std::string& error);
+
+#endif //SCENEFILE_HPP
@@ -3,9 +3,14 @@
 
 #include "Screen.hpp"
 
+#include <bit>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <string>
 #include "lodepng.h"
+#include "TileScheduler.hpp"
 
 void printHeader(std::ofstream& ppmFile, const unsigned int width, const unsigned int height) {
     ppmFile << "P3" << std::endl; // Magic Number, we're doing a pixelmap here
@@ -32,14 +37,128 @@ void Screen::printScreenToPPMFile(std::ofstream& ppmFile) {
     printHeader(ppmFile, _width ,_height);
     for( int y = 0; y < _height; y++) {
         for( int x = 0; x < _width; x++) {
-            write_color(ppmFile, _data[_width*y + x]);
+            write_color(ppmFile, getPixel(x, y));
         }
         ppmFile << "\n";
     }
 }
 
+namespace {
+    struct FramebufferHeader {
+        char _magic[8] = {'R', 'T', 'F', 'R', 'A', 'M', 'E', '\0'};
+        uint64_t _width;
+        uint64_t _height;
+        uint64_t _channels;
+        uint64_t _bytesPerChannel;
+        uint64_t _reserved[3] = {};
+    };
+    static_assert(sizeof(FramebufferHeader) == 64, "the pixels start 64 bytes into the file");
+}
+
+void Screen::attach(){
+    if(_mapping.isOpen()) {
+        _data = std::span<unsigned char>(static_cast<unsigned char*>(_mapping.data()) + sizeof(FramebufferHeader), _width * _height * _bytesPerPixel);
+    } else if(_external) {
+        // the last row ends right after its last pixel, whatever the stride
+        _data = std::span<unsigned char>(_external, _height == 0 ? 0 : (_height - 1) * _rowStride + _width * _bytesPerPixel);
+    } else {
+        _data = std::span<unsigned char>(_storage);
+    }
+}
+
+Screen::Screen(const Screen& other):_width(other._width), _height(other._height), _format(other._format), _bytesPerPixel(other._bytesPerPixel), _rowStride(other._rowStride), _storage(other._data.begin(), other._data.end()){
+    attach();
+}
+
+Screen::Screen(Screen&& other) noexcept:_width(other._width), _height(other._height), _format(other._format), _bytesPerPixel(other._bytesPerPixel), _rowStride(other._rowStride), _storage(std::move(other._storage)), _mapping(std::move(other._mapping)), _external(other._external){
+    attach();
+    other._external = nullptr;
+    other._data = {};
+}
+
+Screen& Screen::operator=(const Screen& other){
+    if(this != &other) {
+        _width = other._width;
+        _height = other._height;
+        _format = other._format;
+        _bytesPerPixel = other._bytesPerPixel;
+        _rowStride = other._rowStride;
+        _mapping.close();
+        _external = nullptr;
+        _storage.assign(other._data.begin(), other._data.end());
+        attach();
+    }
+    return *this;
+}
+
+Screen& Screen::operator=(Screen&& other) noexcept{
+    if(this != &other) {
+        _width = other._width;
+        _height = other._height;
+        _format = other._format;
+        _bytesPerPixel = other._bytesPerPixel;
+        _rowStride = other._rowStride;
+        _storage = std::move(other._storage);
+        _mapping = std::move(other._mapping);
+        _external = other._external;
+        attach();
+        other._external = nullptr;
+        other._data = {};
+    }
+    return *this;
+}
+
+std::optional<Screen> Screen::mapFile(const char *filename, uint64_t width, uint64_t height, PixelFormat format){
+    std::optional<MappedFile> mapping = MappedFile::create(filename, sizeof(FramebufferHeader) + width * height * bytesPerPixel(format));
+    if(!mapping) {
+        return {};
+    }
+    FramebufferHeader header;
+    header._width = width;
+    header._height = height;
+    header._channels = channelCount(format);
+    header._bytesPerChannel = bytesPerPixel(format) / header._channels;
+    std::memcpy(mapping->data(), &header, sizeof(header));
+    Screen screen(0, 0, format);
+    screen._width = width;
+    screen._height = height;
+    screen._rowStride = width * screen._bytesPerPixel;
+    screen._mapping = std::move(*mapping);
+    screen.attach();
+    screen.clear(); // the file starts out all zeros, which is black but also transparent
+    return screen;
+}
+
+bool Screen::isMapped() const{
+    return _mapping.isOpen();
+}
+
+Screen Screen::view(void* pixels, uint64_t width, uint64_t height, PixelFormat format, uint64_t rowStride){
+    Screen screen(0, 0, format);
+    screen._width = width;
+    screen._height = height;
+    screen._rowStride = rowStride == 0 ? width * screen._bytesPerPixel : rowStride;
+    screen._external = static_cast<unsigned char*>(pixels);
+    screen.attach();
+    return screen;
+}
+
+bool Screen::isView() const{
+    return _external != nullptr;
+}
+
+bool Screen::flush(){
+    return _mapping.flush();
+}
+
 void Screen::setPixel(uint64_t  x, uint64_t  y, vec3 c){
-    _data[_width*y + x] = c;
+    storePixel(_format, &_data[_rowStride*y + x * _bytesPerPixel], c, x, y);
+}
+color Screen::getPixel(uint64_t x, uint64_t y) const{
+    return loadPixel(_format, &_data[_rowStride*y + x * _bytesPerPixel]);
+}
+PixelFormat Screen::getPixelFormat() const{
+    return _format;
 }
 uint64_t  Screen::getWidth() const{
     return _width;
@@ -48,8 +167,10 @@ uint64_t  Screen::getHeight() const{
     return _height;
 }
 void Screen::clear(){
-    for(auto& i: _data){
-        i = {0,0,0};
+    for(uint64_t y = 0; y < _height; ++y) {
+        for(uint64_t x = 0; x < _width; ++x) {
+            setPixel(x, y, color(0,0,0));
+        }
     }
 }
 
@@ -58,15 +179,70 @@ void Screen::saveAsPPM(const char *filename){
     printScreenToPPMFile(ppmFile);
 }
 
-void Screen::saveAsPNG(const char *filename) {
-    std::vector<unsigned char> temp_data;
-    for(auto pixel: _data) {
-        temp_data.push_back(int(255.999 * pixel.x()));
-        temp_data.push_back(int(255.999 * pixel.y()));
-        temp_data.push_back(int(255.999 * pixel.z()));
-        temp_data.push_back(int(255.0));
+namespace {
+    bool writeFile(const char *filename, const std::vector<unsigned char>& bytes) {
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize) bytes.size());
+        return file.good();
+    }
+}
+
+bool Screen::saveAsP6(const char *filename) const {
+    std::string header = "P6\n" + std::to_string(_width) + " " + std::to_string(_height) + "\n255\n";
+    std::vector<unsigned char> file(header.size() + _width * _height * 3);
+    std::memcpy(file.data(), header.data(), header.size());
+    unsigned char* target = file.data() + header.size();
+    for(uint64_t y = 0; y < _height; ++y) {
+        for(uint64_t x = 0; x < _width; ++x) {
+            // the same conversion as write_color, the P3 writer
+            color pixel = getPixel(x, y);
+            *target++ = (unsigned char) int(255.999 * pixel.x());
+            *target++ = (unsigned char) int(255.999 * pixel.y());
+            *target++ = (unsigned char) int(255.999 * pixel.z());
+        }
+    }
+    return writeFile(filename, file);
+}
+
+bool Screen::saveAsFloat32(const char *filename) const {
+    std::vector<unsigned char> file(_width * _height * 3 * sizeof(float));
+    unsigned char* target = file.data();
+    for(uint64_t y = 0; y < _height; ++y) {
+        for(uint64_t x = 0; x < _width; ++x) {
+            color pixel = getPixel(x, y);
+            for(int i = 0; i < 3; ++i) {
+                uint32_t bits = std::bit_cast<uint32_t>((float) pixel[i]);
+                // byte by byte, so the file is little endian whatever machine wrote it
+                *target++ = (unsigned char) bits;
+                *target++ = (unsigned char) (bits >> 8);
+                *target++ = (unsigned char) (bits >> 16);
+                *target++ = (unsigned char) (bits >> 24);
+            }
+        }
     }
-    unsigned error = lodepng::encode(filename, temp_data, _width, _height);
-    std::cout << error << std::endl;
+    return writeFile(filename, file);
+}
+
+PNGEncodeStats Screen::saveAsPNG(const char *filename, PNGProfile profile) {
+    std::vector<unsigned char> png;
+    PNGEncodeStats stats = encodePNG(png, profile);
+    if(!stats._error) {
+        stats._error = lodepng::save_file(png, filename);
+    }
+    std::cout << stats._error << std::endl;
+    return stats;
+}
 
+PNGEncodeStats Screen::encodePNG(std::vector<unsigned char>& png, PNGProfile profile, unsigned threadCount) const {
+    auto start = std::chrono::steady_clock::now();
+    // the strips are independent, so they're spread over the cores like the tiles of a render
+    PNGEncoder encoder(_width, _height);
+    encoder.setProfile(profile);
+    TileScheduler scheduler(1, 1, threadCount);
+    scheduler.run(encoder.getStripCount(), [&](uint64_t strip, unsigned) {
+        encoder.encodeStrip(*this, strip);
+    });
+    unsigned error = encoder.finish(png);
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    return PNGEncodeStats{profile, seconds.count(), png.size(), error};
 }
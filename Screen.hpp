@@ -4,8 +4,13 @@
 #define SCREEN_HPP
 
 #include <cstdint>
+#include <optional>
+#include <span>
 #include <vector>
 #include "Vector3.hpp"
+#include "MappedFile.hpp"
+#include "PixelFormat.hpp"
+#include "PNGEncoder.hpp"
 
 
 
@@ -14,21 +19,60 @@ using color = vec3;
 class Screen{
     uint64_t _width;
     uint64_t _height;
-    std::vector<color> _data;
+    PixelFormat _format;
+    uint32_t _bytesPerPixel;
+    uint64_t _rowStride;                 // bytes from the start of one row to the start of the next
+    std::vector<unsigned char> _storage; // the pixels, unless the screen is backed by a file or is a view
+    MappedFile _mapping;                 // the file, see mapFile
+    unsigned char* _external = nullptr;  // somebody else's pixels, see view
+    std::span<unsigned char> _data;      // the pixels in _format, wherever they are
+
+    void attach();
 public:
-    Screen():_width(1024), _height(1024){
-        _data.resize(_width*_height);
-    }
-    Screen(uint64_t  width, uint64_t  height):_width(width), _height(height){
-        _data.resize(width * height);
+    Screen():Screen(1024, 1024){}
+    // format says how the pixels are kept, see PixelFormat. The default keeps the doubles as they are
+    Screen(uint64_t  width, uint64_t  height, PixelFormat format = PixelFormat::RGB64F)
+        :_width(width), _height(height), _format(format), _bytesPerPixel(bytesPerPixel(format)), _rowStride(width * _bytesPerPixel){
+        _storage.resize(width * height * _bytesPerPixel);
+        attach();
     }
+    // a copy always lives on the heap, even if the original is a mapped file or a view
+    Screen(const Screen& other);
+    Screen(Screen&& other) noexcept;
+    Screen& operator=(const Screen& other);
+    Screen& operator=(Screen&& other) noexcept;
+
+    // A screen whose pixels live in a memory mapped file instead of on the heap, so it can be bigger than the RAM
+    // and another process (a compositor) can map the same file and read the frame without any copying. The file
+    // starts with a 64 byte header (see FramebufferHeader in Screen.cpp: magic "RTFRAME", width, height, channels,
+    // bytes per channel) followed by width * height pixels in the given format (native byte order), row by row from
+    // the top. Nothing if the file can't be created or mapped.
+    static std::optional<Screen> mapFile(const char *filename, uint64_t width, uint64_t height, PixelFormat format = PixelFormat::RGB64F);
+    bool isMapped() const;
+    // A screen that renders straight into memory the caller owns, e.g. a compositor's frame buffer: width * height
+    // pixels in the given format, rows rowStride bytes apart (0: no gap between the rows). Nothing is copied or
+    // allocated, and the memory has to stay valid for as long as the screen (or a moved-to screen) is used
+    static Screen view(void* pixels, uint64_t width, uint64_t height, PixelFormat format = PixelFormat::RGB64F, uint64_t rowStride = 0);
+    bool isView() const;
+    bool flush(); // writes a mapped screen back to its file, false if it isn't mapped
+
     void setPixel(uint64_t  x, uint64_t  y, vec3 c);
+    color getPixel(uint64_t x, uint64_t y) const; // what's stored, so rounded to the pixel format
+    PixelFormat getPixelFormat() const;
     uint64_t getWidth() const;
     uint64_t getHeight() const;
     void printScreenToPPMFile(std::ofstream& ppmFile);
     void clear();
     void saveAsPPM(const char *filename);
-    void saveAsPNG(const char *filename);
+    // binary PPM (P6), 8 bit per channel. The whole file is put together in memory and written in one go
+    bool saveAsP6(const char *filename) const;
+    // the pixels as raw little endian float32 RGB triples, row by row from the top, no header: width * height * 12 bytes.
+    // For compositing tools that want the unclamped values; also written in one go
+    bool saveAsFloat32(const char *filename) const;
+    PNGEncodeStats saveAsPNG(const char *filename, PNGProfile profile = PNGProfile::Default);
+    // the PNG file in memory, encoded in strips on threadCount threads (0: all cores). The stats say how long that
+    // took and how big the file got, the time doesn't include writing it anywhere
+    PNGEncodeStats encodePNG(std::vector<unsigned char>& png, PNGProfile profile = PNGProfile::Default, unsigned threadCount = 0) const;
 };
 
 #endif //SCREEN_HPP
@@ -2,17 +2,21 @@
 
 #ifndef SPHERE_HPP
 #define SPHERE_HPP
+#include <cstdint>
 #include <utility>
 
-#include "Material.hpp"
 #include "Vector3.hpp"
 
+// position of a material in Scene::materials. Many spheres share a handful of materials, so a sphere only keeps the
+// index and the materials themselves sit together in one small table that stays in the cache
+using MaterialIndex = uint32_t;
+
 struct Sphere {
     double _radius;
     double _radius_squared;
     vec3 _center;
-    Material _material;
-    Sphere(double radius, vec3 center, Material material): _radius(radius), _center(center), _radius_squared(radius*radius), _material(material) {}
+    MaterialIndex _material;
+    Sphere(double radius, vec3 center, MaterialIndex material): _radius(radius), _center(center), _radius_squared(radius*radius), _material(material) {}
 };
 
 
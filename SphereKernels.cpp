@@ -0,0 +1,94 @@
+
+
+#include "SphereKernels.hpp"
+
+#include <algorithm>
+
+// the scalar code, and the kernels for whatever the rest of the program is compiled for (SSE2 on a generic x86-64
+// build). Both always run
+#define RAYTRACE_KERNELS scalarSphereKernels
+#define RAYTRACE_KERNELS_SCALAR
+#include "SphereKernelsImpl.hpp"
+#undef RAYTRACE_KERNELS_SCALAR
+
+#define RAYTRACE_KERNELS baselineSphereKernels
+#include "SphereKernelsImpl.hpp"
+
+// constant initialized, so it's valid before any constructor runs
+const KernelSet* activeKernelSet = &baselineSphereKernels::kernels;
+
+// the ones compiled with more instruction sets, see CMakeLists.txt
+#if defined(RAYTRACE_DISPATCH)
+namespace sse42SphereKernels { extern const KernelSet kernels; }
+namespace avx2SphereKernels { extern const KernelSet kernels; }
+namespace avx512SphereKernels { extern const KernelSet kernels; }
+#endif
+
+namespace {
+    // whether the CPU can run the kernel set called name, asked via CPUID. The builtin also checks that the OS
+    // saves the wider registers on a context switch, which a CPU flag alone doesn't say
+    bool cpuSupports(const std::string& name) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+        __builtin_cpu_init();
+        if (name == "sse2") {
+            return __builtin_cpu_supports("sse2");
+        } else if (name == "sse4.1") {
+            return __builtin_cpu_supports("sse4.1");
+        } else if (name == "sse4.2") {
+            return __builtin_cpu_supports("sse4.2");
+        } else if (name == "avx") {
+            return __builtin_cpu_supports("avx");
+        } else if (name == "avx2") {
+            return __builtin_cpu_supports("avx2");
+        } else if (name == "avx512") {
+            return __builtin_cpu_supports("avx512f");
+        }
+#endif
+        return name == "scalar";
+    }
+
+    std::vector<KernelSet> findSupportedKernels() {
+        // the baseline set runs wherever the rest of the program does. Without SIMD it is the scalar code again
+        KernelSet baseline = baselineSphereKernels::kernels;
+        std::vector<KernelSet> supported = {scalarSphereKernels::kernels};
+        if (baseline._name != std::string("scalar")) {
+            supported.push_back(baseline);
+        }
+#if defined(RAYTRACE_DISPATCH)
+        for (const KernelSet& candidate : {sse42SphereKernels::kernels, avx2SphereKernels::kernels, avx512SphereKernels::kernels}) {
+            // a build with extra flags can make the baseline the same as one of these
+            if (candidate._name != std::string(baseline._name) && cpuSupports(candidate._name)) {
+                supported.push_back(candidate);
+            }
+        }
+#endif
+        // narrowest to widest; stable, so where the width is the same the later instruction set stays behind
+        std::stable_sort(supported.begin(), supported.end(), [](const KernelSet& a, const KernelSet& b) {
+            return a._double._laneWidth < b._double._laneWidth;
+        });
+        return supported;
+    }
+
+    // the program starts out with the baseline kernels (see activeKernelSet) and switches to the widest
+    // supported ones here, before main() runs
+    [[maybe_unused]] const bool widestSelected = (activeKernelSet = &supportedKernels().back(), true);
+}
+
+const std::vector<KernelSet>& supportedKernels() {
+    static const std::vector<KernelSet> supported = findSupportedKernels();
+    return supported;
+}
+
+const KernelSet& scalarKernels() {
+    return supportedKernels().front();
+}
+
+bool selectKernels(const std::string& name) {
+    for (const KernelSet& kernels : supportedKernels()) {
+        if (name == kernels._name) {
+            activeKernelSet = &kernels;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,86 @@
+
+
+#ifndef SPHEREKERNELS_HPP
+#define SPHEREKERNELS_HPP
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Intersection.hpp"
+#include "Material.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+
+// One packed sphere as seen from a fixed point, the eye: the part of the sphere test that doesn't depend on the ray
+// direction, computed exactly as the test itself would. All primary rays start at the eye, so this is worked out once
+// per frame (BasicSpherePack::eyeRelative) and not again for every packet. Kept together per sphere, because the
+// packet test takes one sphere at a time and broadcasts these to all lanes
+template<typename Real>
+struct EyeRelativeSphere {
+    Real _distX, _distY, _distZ; // center - eye
+    Real _length2;               // |center - eye|^2
+    Real _radiusSquared;
+};
+
+// What the kernels get to see of a BasicSpherePack: plain pointers to its arrays (see there), nothing else
+template<typename Real>
+struct PackedSpheres {
+    const Real* _centerX;
+    const Real* _centerY;
+    const Real* _centerZ;
+    const Real* _radiusSquared;
+    const uint32_t* _sphereIndex;
+    const uint32_t* _materialIndex;
+    const Material* _materials;
+};
+
+// The sphere tests of BasicSpherePack, compiled for one instruction set. What each of them does is described at the
+// BasicSpherePack function of the same name; indices are pack indices, skip is noHit for none, and eye is nullptr
+// or points to BasicSpherePack::eyeRelative for the whole pack
+template<typename Real>
+struct SphereKernels {
+    uint32_t _laneWidth; // spheres tested per SIMD instruction
+    void (*_intersect)(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, Hit& best, uint32_t skip);
+    bool (*_occludes)(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, double tMax, uint32_t skip);
+    void (*_intersectPacket)(const PackedSpheres<Real>& pack, RayPacket& packet, uint32_t first, uint32_t count, const EyeRelativeSphere<Real>* eye);
+};
+
+// The kernels of one instruction set, in both precisions.
+// We ship one binary to machines with anything from SSE2 to AVX-512, so the kernels are compiled several times
+// (SphereKernelsImpl.hpp, included by SphereKernels*.cpp with different compiler flags) and the widest one the CPU
+// can run is picked when the program starts. Every variant does the same arithmetic in the same order as the scalar
+// code, only on more spheres at a time, so they all give bit for bit the same distances; the benchmark checks that
+// (benchmark --verify-kernels). The shading code is plain scalar double math and stays generic.
+struct KernelSet {
+    const char* _name; // "scalar", "sse2", "sse4.1", "sse4.2", "avx", "avx2" or "avx512"
+    SphereKernels<double> _double;
+    SphereKernels<float> _float;
+
+    template<typename Real>
+    const SphereKernels<Real>& get() const {
+        if constexpr (std::is_same_v<Real, float>) {
+            return _float;
+        } else {
+            return _double;
+        }
+    }
+};
+
+// The kernel sets built into this binary that the CPU we run on can execute, the plain scalar code first and the
+// widest last. Which ones are built depends on the build, see RAYTRACE_DISPATCH in CMakeLists.txt
+const std::vector<KernelSet>& supportedKernels();
+// the scalar code, one sphere at a time. Always there
+const KernelSet& scalarKernels();
+// the set BasicSpherePack uses, the widest supported one unless selectKernels said otherwise. Looked at for every
+// sphere test, so it's a plain pointer and not a function local static behind a guard
+extern const KernelSet* activeKernelSet;
+inline const KernelSet& activeKernels() {
+    return *activeKernelSet;
+}
+// makes the supported set called name the active one, false if there is none. Not thread safe: meant for the
+// command line, before anything is rendered
+bool selectKernels(const std::string& name);
+
+#endif //SPHEREKERNELS_HPP
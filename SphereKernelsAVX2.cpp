@@ -0,0 +1,5 @@
+
+
+// The sphere kernels compiled for AVX2, see SphereKernels.hpp. CMakeLists.txt gives this file the flags for it
+#define RAYTRACE_KERNELS avx2SphereKernels
+#include "SphereKernelsImpl.hpp"
@@ -0,0 +1,5 @@
+
+
+// The sphere kernels compiled for AVX-512 (AVX512F), see SphereKernels.hpp. CMakeLists.txt gives this file the flags for it
+#define RAYTRACE_KERNELS avx512SphereKernels
+#include "SphereKernelsImpl.hpp"
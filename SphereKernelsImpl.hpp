@@ -0,0 +1,690 @@
+
+
+// The sphere kernels themselves (see SphereKernels.hpp). No include guard on purpose: SphereKernels.cpp and the
+// SphereKernels<ISA>.cpp files include this with RAYTRACE_KERNELS defined to a namespace of their own, and each gets
+// its own copy of the kernels, compiled for whatever instruction set that file is compiled for.
+// RAYTRACE_KERNELS_SCALAR leaves the SIMD code out altogether.
+//
+// Nothing in here may call an inline function of another header (vec3::operator[], std::span, std::numeric_limits
+// and so on): the compiler is allowed to keep an out of line copy of such a function, compiled with this file's
+// flags, and the linker may then use that copy for the whole program, AVX-512 instructions and all. So there are
+// only intrinsics, builtins and plain arrays in here. The scalar code is the exception, it's only ever compiled with
+// the flags of the rest of the program.
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "SphereKernels.hpp"
+
+#if !defined(RAYTRACE_KERNELS)
+#error "define RAYTRACE_KERNELS to the namespace the kernels go into"
+#endif
+
+// which SIMD code we get, and how many bytes its registers hold (0 for none)
+#if defined(RAYTRACE_KERNELS_SCALAR)
+#define RAYTRACE_KERNELS_BYTES 0
+#elif defined(__AVX512F__)
+#include <immintrin.h>
+#define RAYTRACE_KERNELS_AVX512
+#define RAYTRACE_KERNELS_BYTES 64
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define RAYTRACE_KERNELS_AVX
+#define RAYTRACE_KERNELS_BYTES 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#define RAYTRACE_KERNELS_SSE
+#define RAYTRACE_KERNELS_BYTES 16
+#else
+#define RAYTRACE_KERNELS_BYTES 0
+#endif
+
+namespace RAYTRACE_KERNELS {
+
+    constexpr uint32_t noHit = UINT32_MAX; // SpherePack::noHit
+
+    // the name of this set, after the instruction set it was compiled for (see cpuSupports in SphereKernels.cpp)
+#if defined(RAYTRACE_KERNELS_AVX512)
+    constexpr const char* name = "avx512";
+#elif defined(RAYTRACE_KERNELS_AVX) && defined(__AVX2__)
+    constexpr const char* name = "avx2";
+#elif defined(RAYTRACE_KERNELS_AVX)
+    constexpr const char* name = "avx";
+#elif defined(RAYTRACE_KERNELS_SSE) && defined(__SSE4_2__)
+    constexpr const char* name = "sse4.2";
+#elif defined(RAYTRACE_KERNELS_SSE) && defined(__SSE4_1__)
+    constexpr const char* name = "sse4.1";
+#elif defined(RAYTRACE_KERNELS_SSE)
+    constexpr const char* name = "sse2";
+#else
+    constexpr const char* name = "scalar";
+#endif
+
+    // a candidate hit at distance t on packed sphere index. Same rule as in Scene::intersect
+    inline void keepCloser(double t, uint32_t index, const uint32_t* sphereIndex, Hit& best) {
+        if (best._index == noHit || t < best._t || (t == best._t && sphereIndex[index] < sphereIndex[best._index])) {
+            best._t = t;
+            best._index = index;
+        }
+    }
+
+    // forEachHit(pack, ray, first, count, tMax, onHit) calls onHit(t, index) for every sphere in the range the ray
+    // hits, and stops (returning true) as soon as onHit returns true. Spheres that are only hit beyond tMax may be
+    // left out; tMax is read again for every group of SIMD lanes, so onHit can lower it. One version per instruction
+    // set, picked by the preprocessor
+
+#if defined(RAYTRACE_KERNELS_AVX512)
+
+    // 8 doubles or 16 floats per iteration, calling onHit(t, index) for every sphere the ray hits until it returns
+    // true. The arithmetic is the same as in the scalar code, operation by operation, so the lanes produce
+    // bit-identical distances. Only the lanes that hit (rarely more than one) are looked at individually.
+    // The arrays are only padded for 32 byte loads, so the last group of a range is loaded with a mask; the lanes
+    // left out are never read and never hit
+    template<typename Real, typename OnHit>
+    bool forEachHit(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, const double& tMax, OnHit&& onHit) {
+        const double* o = ray._origin._elements;
+        const double* d = ray._direction._elements;
+        uint32_t end = first + count;
+        if constexpr (std::is_same_v<Real, float>) {
+            __m512 originX = _mm512_set1_ps((float) o[0]), originY = _mm512_set1_ps((float) o[1]), originZ = _mm512_set1_ps((float) o[2]);
+            __m512 dirX = _mm512_set1_ps((float) d[0]), dirY = _mm512_set1_ps((float) d[1]), dirZ = _mm512_set1_ps((float) d[2]);
+            __m512 zero = _mm512_setzero_ps();
+            for (uint32_t i = first; i < end; i += 16) {
+                __mmask16 valid = end - i >= 16 ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (end - i)) - 1);
+                __m512 distX = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, &pack._centerX[i]), originX);
+                __m512 distY = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, &pack._centerY[i]), originY);
+                __m512 distZ = _mm512_sub_ps(_mm512_maskz_loadu_ps(valid, &pack._centerZ[i]), originZ);
+                __m512 projection = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(distX, dirX), _mm512_mul_ps(distY, dirY)), _mm512_mul_ps(distZ, dirZ));
+                // the length of the perpendicular, see the scalar version
+                __m512 perpX = _mm512_sub_ps(distX, _mm512_mul_ps(projection, dirX));
+                __m512 perpY = _mm512_sub_ps(distY, _mm512_mul_ps(projection, dirY));
+                __m512 perpZ = _mm512_sub_ps(distZ, _mm512_mul_ps(projection, dirZ));
+                __m512 dist2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(perpX, perpX), _mm512_mul_ps(perpY, perpY)), _mm512_mul_ps(perpZ, perpZ));
+                __m512 radius2 = _mm512_maskz_loadu_ps(valid, &pack._radiusSquared[i]);
+                uint32_t mask = _mm512_mask_cmp_ps_mask(valid, projection, zero, _CMP_NLT_UQ) & _mm512_cmp_ps_mask(dist2, radius2, _CMP_NGT_UQ);
+                // beyond tMax, see the AVX version
+                __m512 ahead = _mm512_sub_ps(projection, _mm512_set1_ps((float) tMax));
+                mask &= ~(uint32_t) (_mm512_cmp_ps_mask(ahead, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(_mm512_mul_ps(ahead, ahead), _mm512_sub_ps(radius2, dist2), _CMP_GT_OQ));
+                if (mask == 0) {
+                    continue;
+                }
+                __m512 close = _mm512_sqrt_ps(_mm512_sub_ps(radius2, dist2));
+                __m512 tNear = _mm512_sub_ps(projection, close);
+                __m512 tFar = _mm512_add_ps(projection, close);
+                __m512 t = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, zero, _CMP_LT_OQ), tNear, tFar);
+                alignas(64) float ts[16];
+                _mm512_store_ps(ts, t);
+                for (uint32_t lane = 0; lane < 16; ++lane) {
+                    if ((mask & (1u << lane)) && onHit(ts[lane], i + lane)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        } else {
+            __m512d originX = _mm512_set1_pd(o[0]), originY = _mm512_set1_pd(o[1]), originZ = _mm512_set1_pd(o[2]);
+            __m512d dirX = _mm512_set1_pd(d[0]), dirY = _mm512_set1_pd(d[1]), dirZ = _mm512_set1_pd(d[2]);
+            __m512d zero = _mm512_setzero_pd();
+            for (uint32_t i = first; i < end; i += 8) {
+                __mmask8 valid = end - i >= 8 ? (__mmask8) 0xFF : (__mmask8) ((1u << (end - i)) - 1);
+                __m512d distX = _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, &pack._centerX[i]), originX);
+                __m512d distY = _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, &pack._centerY[i]), originY);
+                __m512d distZ = _mm512_sub_pd(_mm512_maskz_loadu_pd(valid, &pack._centerZ[i]), originZ);
+                __m512d projection = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(distX, dirX), _mm512_mul_pd(distY, dirY)), _mm512_mul_pd(distZ, dirZ));
+                __m512d length2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(distX, distX), _mm512_mul_pd(distY, distY)), _mm512_mul_pd(distZ, distZ));
+                __m512d dist2 = _mm512_sub_pd(length2, _mm512_mul_pd(projection, projection));
+                __m512d radius2 = _mm512_maskz_loadu_pd(valid, &pack._radiusSquared[i]);
+                uint32_t mask = _mm512_mask_cmp_pd_mask(valid, projection, zero, _CMP_NLT_UQ) & _mm512_cmp_pd_mask(dist2, radius2, _CMP_NGT_UQ);
+                __m512d ahead = _mm512_sub_pd(projection, _mm512_set1_pd(tMax));
+                mask &= ~(uint32_t) (_mm512_cmp_pd_mask(ahead, zero, _CMP_GT_OQ) & _mm512_cmp_pd_mask(_mm512_mul_pd(ahead, ahead), _mm512_sub_pd(radius2, dist2), _CMP_GT_OQ));
+                if (mask == 0) {
+                    continue;
+                }
+                __m512d close = _mm512_sqrt_pd(_mm512_sub_pd(radius2, dist2));
+                __m512d tNear = _mm512_sub_pd(projection, close);
+                __m512d tFar = _mm512_add_pd(projection, close);
+                __m512d t = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(tNear, zero, _CMP_LT_OQ), tNear, tFar);
+                alignas(64) double ts[8];
+                _mm512_store_pd(ts, t);
+                for (uint32_t lane = 0; lane < 8; ++lane) {
+                    if ((mask & (1u << lane)) && onHit(ts[lane], i + lane)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+    }
+
+#elif defined(RAYTRACE_KERNELS_AVX)
+
+    // 4 doubles or 8 floats per iteration, calling onHit(t, index) for every sphere the ray hits until it returns
+    // true. The arithmetic is the same as in the scalar code, operation by operation, so the lanes produce
+    // bit-identical distances. Only the lanes that hit (rarely more than one) are looked at individually.
+    template<typename Real, typename OnHit>
+    bool forEachHit(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, const double& tMax, OnHit&& onHit) {
+        const double* o = ray._origin._elements;
+        const double* d = ray._direction._elements;
+        uint32_t end = first + count;
+        if constexpr (std::is_same_v<Real, float>) {
+            __m256 originX = _mm256_set1_ps((float) o[0]), originY = _mm256_set1_ps((float) o[1]), originZ = _mm256_set1_ps((float) o[2]);
+            __m256 dirX = _mm256_set1_ps((float) d[0]), dirY = _mm256_set1_ps((float) d[1]), dirZ = _mm256_set1_ps((float) d[2]);
+            __m256 zero = _mm256_setzero_ps();
+            for (uint32_t i = first; i < end; i += 8) {
+                __m256 distX = _mm256_sub_ps(_mm256_loadu_ps(&pack._centerX[i]), originX);
+                __m256 distY = _mm256_sub_ps(_mm256_loadu_ps(&pack._centerY[i]), originY);
+                __m256 distZ = _mm256_sub_ps(_mm256_loadu_ps(&pack._centerZ[i]), originZ);
+                __m256 projection = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(distX, dirX), _mm256_mul_ps(distY, dirY)), _mm256_mul_ps(distZ, dirZ));
+                // the length of the perpendicular, see the scalar version
+                __m256 perpX = _mm256_sub_ps(distX, _mm256_mul_ps(projection, dirX));
+                __m256 perpY = _mm256_sub_ps(distY, _mm256_mul_ps(projection, dirY));
+                __m256 perpZ = _mm256_sub_ps(distZ, _mm256_mul_ps(projection, dirZ));
+                __m256 dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(perpX, perpX), _mm256_mul_ps(perpY, perpY)), _mm256_mul_ps(perpZ, perpZ));
+                __m256 radius2 = _mm256_loadu_ps(&pack._radiusSquared[i]);
+                __m256 hit = _mm256_and_ps(_mm256_cmp_ps(projection, zero, _CMP_NLT_UQ), _mm256_cmp_ps(dist2, radius2, _CMP_NGT_UQ));
+                // A lane whose near side is beyond tMax can't win, and neither can its far side. projection - close > tMax
+                // is (projection - tMax)^2 > close^2 with projection - tMax > 0, so those lanes are dropped before the sqrt
+                __m256 ahead = _mm256_sub_ps(projection, _mm256_set1_ps((float) tMax));
+                hit = _mm256_andnot_ps(_mm256_and_ps(_mm256_cmp_ps(ahead, zero, _CMP_GT_OQ), _mm256_cmp_ps(_mm256_mul_ps(ahead, ahead), _mm256_sub_ps(radius2, dist2), _CMP_GT_OQ)), hit);
+                int mask = _mm256_movemask_ps(hit);
+                if (end - i < 8) {
+                    mask &= (1 << (end - i)) - 1;
+                }
+                if (mask == 0) {
+                    continue;
+                }
+                __m256 close = _mm256_sqrt_ps(_mm256_sub_ps(radius2, dist2));
+                __m256 tNear = _mm256_sub_ps(projection, close);
+                __m256 tFar = _mm256_add_ps(projection, close);
+                __m256 t = _mm256_blendv_ps(tNear, tFar, _mm256_cmp_ps(tNear, zero, _CMP_LT_OQ));
+                alignas(32) float ts[8];
+                _mm256_store_ps(ts, t);
+                for (uint32_t lane = 0; lane < 8; ++lane) {
+                    if ((mask & (1 << lane)) && onHit(ts[lane], i + lane)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        } else {
+            __m256d originX = _mm256_set1_pd(o[0]), originY = _mm256_set1_pd(o[1]), originZ = _mm256_set1_pd(o[2]);
+            __m256d dirX = _mm256_set1_pd(d[0]), dirY = _mm256_set1_pd(d[1]), dirZ = _mm256_set1_pd(d[2]);
+            __m256d zero = _mm256_setzero_pd();
+            for (uint32_t i = first; i < end; i += 4) {
+                __m256d distX = _mm256_sub_pd(_mm256_loadu_pd(&pack._centerX[i]), originX);
+                __m256d distY = _mm256_sub_pd(_mm256_loadu_pd(&pack._centerY[i]), originY);
+                __m256d distZ = _mm256_sub_pd(_mm256_loadu_pd(&pack._centerZ[i]), originZ);
+                __m256d projection = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(distX, dirX), _mm256_mul_pd(distY, dirY)), _mm256_mul_pd(distZ, dirZ));
+                __m256d length2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(distX, distX), _mm256_mul_pd(distY, distY)), _mm256_mul_pd(distZ, distZ));
+                __m256d dist2 = _mm256_sub_pd(length2, _mm256_mul_pd(projection, projection));
+                __m256d radius2 = _mm256_loadu_pd(&pack._radiusSquared[i]);
+                // "not less than" / "not greater than" so NaNs behave like the early returns in Ray::intersects
+                __m256d hit = _mm256_and_pd(_mm256_cmp_pd(projection, zero, _CMP_NLT_UQ), _mm256_cmp_pd(dist2, radius2, _CMP_NGT_UQ));
+                // beyond tMax, see the float version above
+                __m256d ahead = _mm256_sub_pd(projection, _mm256_set1_pd(tMax));
+                hit = _mm256_andnot_pd(_mm256_and_pd(_mm256_cmp_pd(ahead, zero, _CMP_GT_OQ), _mm256_cmp_pd(_mm256_mul_pd(ahead, ahead), _mm256_sub_pd(radius2, dist2), _CMP_GT_OQ)), hit);
+                int mask = _mm256_movemask_pd(hit);
+                if (end - i < 4) {
+                    mask &= (1 << (end - i)) - 1;  // lanes past the end of the range belong to somebody else
+                }
+                if (mask == 0) {
+                    continue;
+                }
+                __m256d close = _mm256_sqrt_pd(_mm256_sub_pd(radius2, dist2));
+                __m256d tNear = _mm256_sub_pd(projection, close);
+                __m256d tFar = _mm256_add_pd(projection, close);
+                __m256d t = _mm256_blendv_pd(tNear, tFar, _mm256_cmp_pd(tNear, zero, _CMP_LT_OQ));
+                alignas(32) double ts[4];
+                _mm256_store_pd(ts, t);
+                for (uint32_t lane = 0; lane < 4; ++lane) {
+                    if ((mask & (1 << lane)) && onHit(ts[lane], i + lane)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+    }
+
+#elif defined(RAYTRACE_KERNELS_SSE)
+
+    // mask ? whenSet : whenClear per lane. SSE4.1 has an instruction for that, SSE2 needs three
+    inline __m128 blend(__m128 whenClear, __m128 whenSet, __m128 mask) {
+#if defined(__SSE4_1__)
+        return _mm_blendv_ps(whenClear, whenSet, mask);
+#else
+        return _mm_or_ps(_mm_and_ps(mask, whenSet), _mm_andnot_ps(mask, whenClear));
+#endif
+    }
+
+    inline __m128d blend(__m128d whenClear, __m128d whenSet, __m128d mask) {
+#if defined(__SSE4_1__)
+        return _mm_blendv_pd(whenClear, whenSet, mask);
+#else
+        return _mm_or_pd(_mm_and_pd(mask, whenSet), _mm_andnot_pd(mask, whenClear));
+#endif
+    }
+
+    // 2 doubles or 4 floats per iteration, see the AVX version
+    template<typename Real, typename OnHit>
+    bool forEachHit(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, const double& tMax, OnHit&& onHit) {
+        const double* o = ray._origin._elements;
+        const double* d = ray._direction._elements;
+        uint32_t end = first + count;
+        if constexpr (std::is_same_v<Real, float>) {
+            __m128 originX = _mm_set1_ps((float) o[0]), originY = _mm_set1_ps((float) o[1]), originZ = _mm_set1_ps((float) o[2]);
+            __m128 dirX = _mm_set1_ps((float) d[0]), dirY = _mm_set1_ps((float) d[1]), dirZ = _mm_set1_ps((float) d[2]);
+            __m128 zero = _mm_setzero_ps();
+            for (uint32_t i = first; i < end; i += 4) {
+                __m128 distX = _mm_sub_ps(_mm_loadu_ps(&pack._centerX[i]), originX);
+                __m128 distY = _mm_sub_ps(_mm_loadu_ps(&pack._centerY[i]), originY);
+                __m128 distZ = _mm_sub_ps(_mm_loadu_ps(&pack._centerZ[i]), originZ);
+                __m128 projection = _mm_add_ps(_mm_add_ps(_mm_mul_ps(distX, dirX), _mm_mul_ps(distY, dirY)), _mm_mul_ps(distZ, dirZ));
+                // the length of the perpendicular, see the scalar version
+                __m128 perpX = _mm_sub_ps(distX, _mm_mul_ps(projection, dirX));
+                __m128 perpY = _mm_sub_ps(distY, _mm_mul_ps(projection, dirY));
+                __m128 perpZ = _mm_sub_ps(distZ, _mm_mul_ps(projection, dirZ));
+                __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(perpX, perpX), _mm_mul_ps(perpY, perpY)), _mm_mul_ps(perpZ, perpZ));
+                __m128 radius2 = _mm_loadu_ps(&pack._radiusSquared[i]);
+                __m128 hit = _mm_and_ps(_mm_cmpnlt_ps(projection, zero), _mm_cmpngt_ps(dist2, radius2));
+                // beyond tMax, see the AVX version
+                __m128 ahead = _mm_sub_ps(projection, _mm_set1_ps((float) tMax));
+                hit = _mm_andnot_ps(_mm_and_ps(_mm_cmpgt_ps(ahead, zero), _mm_cmpgt_ps(_mm_mul_ps(ahead, ahead), _mm_sub_ps(radius2, dist2))), hit);
+                int mask = _mm_movemask_ps(hit);
+                if (end - i < 4) {
+                    mask &= (1 << (end - i)) - 1;
+                }
+                if (mask == 0) {
+                    continue;
+                }
+                __m128 close = _mm_sqrt_ps(_mm_sub_ps(radius2, dist2));
+                __m128 tNear = _mm_sub_ps(projection, close);
+                __m128 tFar = _mm_add_ps(projection, close);
+                __m128 t = blend(tNear, tFar, _mm_cmplt_ps(tNear, zero));
+                alignas(16) float ts[4];
+                _mm_store_ps(ts, t);
+                for (uint32_t lane = 0; lane < 4; ++lane) {
+                    if ((mask & (1 << lane)) && onHit(ts[lane], i + lane)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        } else {
+            __m128d originX = _mm_set1_pd(o[0]), originY = _mm_set1_pd(o[1]), originZ = _mm_set1_pd(o[2]);
+            __m128d dirX = _mm_set1_pd(d[0]), dirY = _mm_set1_pd(d[1]), dirZ = _mm_set1_pd(d[2]);
+            __m128d zero = _mm_setzero_pd();
+            for (uint32_t i = first; i < end; i += 2) {
+                __m128d distX = _mm_sub_pd(_mm_loadu_pd(&pack._centerX[i]), originX);
+                __m128d distY = _mm_sub_pd(_mm_loadu_pd(&pack._centerY[i]), originY);
+                __m128d distZ = _mm_sub_pd(_mm_loadu_pd(&pack._centerZ[i]), originZ);
+                __m128d projection = _mm_add_pd(_mm_add_pd(_mm_mul_pd(distX, dirX), _mm_mul_pd(distY, dirY)), _mm_mul_pd(distZ, dirZ));
+                __m128d length2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(distX, distX), _mm_mul_pd(distY, distY)), _mm_mul_pd(distZ, distZ));
+                __m128d dist2 = _mm_sub_pd(length2, _mm_mul_pd(projection, projection));
+                __m128d radius2 = _mm_loadu_pd(&pack._radiusSquared[i]);
+                __m128d hit = _mm_and_pd(_mm_cmpnlt_pd(projection, zero), _mm_cmpngt_pd(dist2, radius2));
+                __m128d ahead = _mm_sub_pd(projection, _mm_set1_pd(tMax));
+                hit = _mm_andnot_pd(_mm_and_pd(_mm_cmpgt_pd(ahead, zero), _mm_cmpgt_pd(_mm_mul_pd(ahead, ahead), _mm_sub_pd(radius2, dist2))), hit);
+                int mask = _mm_movemask_pd(hit);
+                if (end - i < 2) {
+                    mask &= 1;
+                }
+                if (mask == 0) {
+                    continue;
+                }
+                __m128d close = _mm_sqrt_pd(_mm_sub_pd(radius2, dist2));
+                __m128d tNear = _mm_sub_pd(projection, close);
+                __m128d tFar = _mm_add_pd(projection, close);
+                __m128d t = blend(tNear, tFar, _mm_cmplt_pd(tNear, zero));
+                alignas(16) double ts[2];
+                _mm_store_pd(ts, t);
+                for (uint32_t lane = 0; lane < 2; ++lane) {
+                    if ((mask & (1 << lane)) && onHit(ts[lane], i + lane)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+    }
+
+#else
+
+    // Squared distance between the ray and a sphere center at dist from its origin. Ray::intersects takes
+    // |dist|^2 - projection^2, and in float that difference of two big, nearly equal numbers loses most of its
+    // digits as soon as the sphere is a few radii away; the error then moves the hit by many ulps. The length of
+    // the perpendicular itself doesn't have that problem, at the price of three more multiply-subtracts
+    inline float perpendicularSquared(float distX, float distY, float distZ, float projection, float dirX, float dirY, float dirZ) {
+        float perpX = distX - projection * dirX;
+        float perpY = distY - projection * dirY;
+        float perpZ = distZ - projection * dirZ;
+        return perpX * perpX + perpY * perpY + perpZ * perpZ;
+    }
+
+    // exactly the steps of Ray::intersects, one sphere at a time; see there for the geometry
+    template<typename Real, typename OnHit>
+    bool forEachHit(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, const double& tMax, OnHit&& onHit) {
+        const Real o[3] = {(Real) ray._origin._elements[0], (Real) ray._origin._elements[1], (Real) ray._origin._elements[2]};
+        const Real d[3] = {(Real) ray._direction._elements[0], (Real) ray._direction._elements[1], (Real) ray._direction._elements[2]};
+        for (uint32_t i = first; i < first + count; ++i) {
+            Real distX = pack._centerX[i] - o[0];
+            Real distY = pack._centerY[i] - o[1];
+            Real distZ = pack._centerZ[i] - o[2];
+            Real d_projection = distX * d[0] + distY * d[1] + distZ * d[2];
+            if (d_projection < 0) {
+                continue;
+            }
+            Real dist2;
+            if constexpr (std::is_same_v<Real, float>) {
+                dist2 = perpendicularSquared(distX, distY, distZ, d_projection, d[0], d[1], d[2]);
+            } else {
+                dist2 = (distX * distX + distY * distY + distZ * distZ) - d_projection * d_projection;
+            }
+            if (dist2 > pack._radiusSquared[i]) {
+                continue;
+            }
+            Real ahead = d_projection - (Real) tMax;
+            if (ahead > 0 && ahead * ahead > pack._radiusSquared[i] - dist2) {
+                continue; // the near side is beyond tMax already, see the AVX version
+            }
+            Real d_close = std::sqrt(pack._radiusSquared[i] - dist2);
+            Real t = d_projection - d_close;
+            if (t < 0) {
+                t = d_projection + d_close;
+            }
+            if (onHit(t, i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+#endif
+
+    template<typename Real>
+    void intersect(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, Hit& best, uint32_t skip) {
+        // skip is filtered here and not in the SIMD loops: hits are rare, the lanes that don't hit cost nothing extra.
+        // best._t only counts once something has been hit
+        double tMax = best._index == noHit ? __builtin_inf() : best._t;
+        forEachHit(pack, ray, first, count, tMax, [&](double t, uint32_t index) {
+            if (index != skip) {
+                keepCloser(t, index, pack._sphereIndex, best);
+                tMax = best._t;
+            }
+            return false;
+        });
+    }
+
+    template<typename Real>
+    bool occludes(const PackedSpheres<Real>& pack, const Ray& ray, uint32_t first, uint32_t count, double tMax, uint32_t skip) {
+        // any hit before tMax will do, we don't care which one is the closest
+        return forEachHit(pack, ray, first, count, tMax, [&](double t, uint32_t index) {
+            return t < tMax && index != skip && pack._materials[pack._materialIndex[index]].isShadowCaster();
+        });
+    }
+
+    template<typename Real>
+    void intersectPacket(const PackedSpheres<Real>& pack, RayPacket& packet, uint32_t first, uint32_t count, const EyeRelativeSphere<Real>* eye) {
+        // Per sphere, everything that only depends on the sphere and the shared origin is computed once, in the same
+        // order as in Ray::intersects, and then the lanes of the packet each get their own projection and distance.
+        // With eye that part was done before the frame started and is only loaded here.
+        // The packet holds doubles; a float pack converts the origin and the directions once per call
+        const double* origin = packet._origin._elements;
+        const Real o[3] = {(Real) origin[0], (Real) origin[1], (Real) origin[2]};
+        alignas(64) float converted[3][RayPacket::size];
+        const Real* directionX;
+        const Real* directionY;
+        const Real* directionZ;
+        if constexpr (std::is_same_v<Real, double>) {
+            directionX = packet._directionX;
+            directionY = packet._directionY;
+            directionZ = packet._directionZ;
+        } else {
+            for (uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                converted[0][lane] = (float) packet._directionX[lane];
+                converted[1][lane] = (float) packet._directionY[lane];
+                converted[2][lane] = (float) packet._directionZ[lane];
+            }
+            directionX = converted[0];
+            directionY = converted[1];
+            directionZ = converted[2];
+        }
+        for (uint32_t i = first; i < first + count; ++i) {
+            Real distX, distY, distZ, length2, radius2;
+            if (eye != nullptr) {
+                distX = eye[i]._distX;
+                distY = eye[i]._distY;
+                distZ = eye[i]._distZ;
+                length2 = eye[i]._length2;
+                radius2 = eye[i]._radiusSquared;
+            } else {
+                distX = pack._centerX[i] - o[0];
+                distY = pack._centerY[i] - o[1];
+                distZ = pack._centerZ[i] - o[2];
+                length2 = distX * distX + distY * distY + distZ * distZ;
+                radius2 = pack._radiusSquared[i];
+            }
+#if defined(RAYTRACE_KERNELS_AVX512)
+            if constexpr (std::is_same_v<Real, float>) {
+                // all 16 rays of the packet in one go
+                __m512 vDistX = _mm512_set1_ps(distX), vDistY = _mm512_set1_ps(distY), vDistZ = _mm512_set1_ps(distZ);
+                __m512 vRadius2 = _mm512_set1_ps(radius2), zero = _mm512_setzero_ps();
+                static_assert(RayPacket::size == 16);
+                __mmask16 active = (__mmask16) packet._activeMask;
+                __m512 dirX = _mm512_loadu_ps(directionX), dirY = _mm512_loadu_ps(directionY), dirZ = _mm512_loadu_ps(directionZ);
+                __m512 projection = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vDistX, dirX), _mm512_mul_ps(vDistY, dirY)), _mm512_mul_ps(vDistZ, dirZ));
+                __m512 perpX = _mm512_sub_ps(vDistX, _mm512_mul_ps(projection, dirX));
+                __m512 perpY = _mm512_sub_ps(vDistY, _mm512_mul_ps(projection, dirY));
+                __m512 perpZ = _mm512_sub_ps(vDistZ, _mm512_mul_ps(projection, dirZ));
+                __m512 dist2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(perpX, perpX), _mm512_mul_ps(perpY, perpY)), _mm512_mul_ps(perpZ, perpZ));
+                uint32_t mask = _mm512_mask_cmp_ps_mask(active, projection, zero, _CMP_NLT_UQ) & _mm512_cmp_ps_mask(dist2, vRadius2, _CMP_NGT_UQ);
+                if (mask == 0) {
+                    continue;
+                }
+                __m512 close = _mm512_sqrt_ps(_mm512_sub_ps(vRadius2, dist2));
+                __m512 tNear = _mm512_sub_ps(projection, close);
+                __m512 tFar = _mm512_add_ps(projection, close);
+                alignas(64) float ts[16];
+                _mm512_store_ps(ts, _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, zero, _CMP_LT_OQ), tNear, tFar));
+                for (uint32_t l = 0; l < 16; ++l) {
+                    if (mask & (1u << l)) {
+                        keepCloser(ts[l], i, pack._sphereIndex, packet._hits[l]);
+                    }
+                }
+            } else {
+                __m512d vDistX = _mm512_set1_pd(distX), vDistY = _mm512_set1_pd(distY), vDistZ = _mm512_set1_pd(distZ);
+                __m512d vLength2 = _mm512_set1_pd(length2), vRadius2 = _mm512_set1_pd(radius2), zero = _mm512_setzero_pd();
+                for (uint32_t lane = 0; lane < RayPacket::size; lane += 8) {
+                    __mmask8 active = (__mmask8) (packet._activeMask >> lane);
+                    if (active == 0) {
+                        continue;
+                    }
+                    __m512d projection = _mm512_add_pd(_mm512_add_pd(
+                            _mm512_mul_pd(vDistX, _mm512_loadu_pd(&directionX[lane])),
+                            _mm512_mul_pd(vDistY, _mm512_loadu_pd(&directionY[lane]))),
+                            _mm512_mul_pd(vDistZ, _mm512_loadu_pd(&directionZ[lane])));
+                    __m512d dist2 = _mm512_sub_pd(vLength2, _mm512_mul_pd(projection, projection));
+                    uint32_t mask = _mm512_mask_cmp_pd_mask(active, projection, zero, _CMP_NLT_UQ) & _mm512_cmp_pd_mask(dist2, vRadius2, _CMP_NGT_UQ);
+                    if (mask == 0) {
+                        continue;
+                    }
+                    __m512d close = _mm512_sqrt_pd(_mm512_sub_pd(vRadius2, dist2));
+                    __m512d tNear = _mm512_sub_pd(projection, close);
+                    __m512d tFar = _mm512_add_pd(projection, close);
+                    alignas(64) double ts[8];
+                    _mm512_store_pd(ts, _mm512_mask_blend_pd(_mm512_cmp_pd_mask(tNear, zero, _CMP_LT_OQ), tNear, tFar));
+                    for (uint32_t l = 0; l < 8; ++l) {
+                        if (mask & (1u << l)) {
+                            keepCloser(ts[l], i, pack._sphereIndex, packet._hits[lane + l]);
+                        }
+                    }
+                }
+            }
+#elif defined(RAYTRACE_KERNELS_AVX)
+            if constexpr (std::is_same_v<Real, float>) {
+                __m256 vDistX = _mm256_set1_ps(distX), vDistY = _mm256_set1_ps(distY), vDistZ = _mm256_set1_ps(distZ);
+                __m256 vRadius2 = _mm256_set1_ps(radius2), zero = _mm256_setzero_ps();
+                for (uint32_t lane = 0; lane < RayPacket::size; lane += 8) {
+                    uint32_t active = (packet._activeMask >> lane) & 0xFFu;
+                    if (active == 0) {
+                        continue;
+                    }
+                    __m256 dirX = _mm256_load_ps(&directionX[lane]), dirY = _mm256_load_ps(&directionY[lane]), dirZ = _mm256_load_ps(&directionZ[lane]);
+                    __m256 projection = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vDistX, dirX), _mm256_mul_ps(vDistY, dirY)), _mm256_mul_ps(vDistZ, dirZ));
+                    __m256 perpX = _mm256_sub_ps(vDistX, _mm256_mul_ps(projection, dirX));
+                    __m256 perpY = _mm256_sub_ps(vDistY, _mm256_mul_ps(projection, dirY));
+                    __m256 perpZ = _mm256_sub_ps(vDistZ, _mm256_mul_ps(projection, dirZ));
+                    __m256 dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(perpX, perpX), _mm256_mul_ps(perpY, perpY)), _mm256_mul_ps(perpZ, perpZ));
+                    __m256 hit = _mm256_and_ps(_mm256_cmp_ps(projection, zero, _CMP_NLT_UQ), _mm256_cmp_ps(dist2, vRadius2, _CMP_NGT_UQ));
+                    uint32_t mask = (uint32_t) _mm256_movemask_ps(hit) & active;
+                    if (mask == 0) {
+                        continue;
+                    }
+                    __m256 close = _mm256_sqrt_ps(_mm256_sub_ps(vRadius2, dist2));
+                    __m256 tNear = _mm256_sub_ps(projection, close);
+                    __m256 tFar = _mm256_add_ps(projection, close);
+                    alignas(32) float ts[8];
+                    _mm256_store_ps(ts, _mm256_blendv_ps(tNear, tFar, _mm256_cmp_ps(tNear, zero, _CMP_LT_OQ)));
+                    for (uint32_t l = 0; l < 8; ++l) {
+                        if (mask & (1u << l)) {
+                            keepCloser(ts[l], i, pack._sphereIndex, packet._hits[lane + l]);
+                        }
+                    }
+                }
+            } else {
+                __m256d vDistX = _mm256_set1_pd(distX), vDistY = _mm256_set1_pd(distY), vDistZ = _mm256_set1_pd(distZ);
+                __m256d vLength2 = _mm256_set1_pd(length2), vRadius2 = _mm256_set1_pd(radius2), zero = _mm256_setzero_pd();
+                for (uint32_t lane = 0; lane < RayPacket::size; lane += 4) {
+                    uint32_t active = (packet._activeMask >> lane) & 0xFu;
+                    if (active == 0) {
+                        continue;
+                    }
+                    __m256d projection = _mm256_add_pd(_mm256_add_pd(
+                            _mm256_mul_pd(vDistX, _mm256_load_pd(&directionX[lane])),
+                            _mm256_mul_pd(vDistY, _mm256_load_pd(&directionY[lane]))),
+                            _mm256_mul_pd(vDistZ, _mm256_load_pd(&directionZ[lane])));
+                    __m256d dist2 = _mm256_sub_pd(vLength2, _mm256_mul_pd(projection, projection));
+                    __m256d hit = _mm256_and_pd(_mm256_cmp_pd(projection, zero, _CMP_NLT_UQ), _mm256_cmp_pd(dist2, vRadius2, _CMP_NGT_UQ));
+                    uint32_t mask = (uint32_t) _mm256_movemask_pd(hit) & active;
+                    if (mask == 0) {
+                        continue;
+                    }
+                    __m256d close = _mm256_sqrt_pd(_mm256_sub_pd(vRadius2, dist2));
+                    __m256d tNear = _mm256_sub_pd(projection, close);
+                    __m256d tFar = _mm256_add_pd(projection, close);
+                    alignas(32) double ts[4];
+                    _mm256_store_pd(ts, _mm256_blendv_pd(tNear, tFar, _mm256_cmp_pd(tNear, zero, _CMP_LT_OQ)));
+                    for (uint32_t l = 0; l < 4; ++l) {
+                        if (mask & (1u << l)) {
+                            keepCloser(ts[l], i, pack._sphereIndex, packet._hits[lane + l]);
+                        }
+                    }
+                }
+            }
+#elif defined(RAYTRACE_KERNELS_SSE)
+            if constexpr (std::is_same_v<Real, float>) {
+                __m128 vDistX = _mm_set1_ps(distX), vDistY = _mm_set1_ps(distY), vDistZ = _mm_set1_ps(distZ);
+                __m128 vRadius2 = _mm_set1_ps(radius2), zero = _mm_setzero_ps();
+                for (uint32_t lane = 0; lane < RayPacket::size; lane += 4) {
+                    uint32_t active = (packet._activeMask >> lane) & 0xFu;
+                    if (active == 0) {
+                        continue;
+                    }
+                    __m128 dirX = _mm_load_ps(&directionX[lane]), dirY = _mm_load_ps(&directionY[lane]), dirZ = _mm_load_ps(&directionZ[lane]);
+                    __m128 projection = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vDistX, dirX), _mm_mul_ps(vDistY, dirY)), _mm_mul_ps(vDistZ, dirZ));
+                    __m128 perpX = _mm_sub_ps(vDistX, _mm_mul_ps(projection, dirX));
+                    __m128 perpY = _mm_sub_ps(vDistY, _mm_mul_ps(projection, dirY));
+                    __m128 perpZ = _mm_sub_ps(vDistZ, _mm_mul_ps(projection, dirZ));
+                    __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(perpX, perpX), _mm_mul_ps(perpY, perpY)), _mm_mul_ps(perpZ, perpZ));
+                    __m128 hit = _mm_and_ps(_mm_cmpnlt_ps(projection, zero), _mm_cmpngt_ps(dist2, vRadius2));
+                    uint32_t mask = (uint32_t) _mm_movemask_ps(hit) & active;
+                    if (mask == 0) {
+                        continue;
+                    }
+                    __m128 close = _mm_sqrt_ps(_mm_sub_ps(vRadius2, dist2));
+                    __m128 tNear = _mm_sub_ps(projection, close);
+                    __m128 tFar = _mm_add_ps(projection, close);
+                    alignas(16) float ts[4];
+                    _mm_store_ps(ts, blend(tNear, tFar, _mm_cmplt_ps(tNear, zero)));
+                    for (uint32_t l = 0; l < 4; ++l) {
+                        if (mask & (1u << l)) {
+                            keepCloser(ts[l], i, pack._sphereIndex, packet._hits[lane + l]);
+                        }
+                    }
+                }
+            } else {
+                __m128d vDistX = _mm_set1_pd(distX), vDistY = _mm_set1_pd(distY), vDistZ = _mm_set1_pd(distZ);
+                __m128d vLength2 = _mm_set1_pd(length2), vRadius2 = _mm_set1_pd(radius2), zero = _mm_setzero_pd();
+                for (uint32_t lane = 0; lane < RayPacket::size; lane += 2) {
+                    uint32_t active = (packet._activeMask >> lane) & 0x3u;
+                    if (active == 0) {
+                        continue;
+                    }
+                    __m128d projection = _mm_add_pd(_mm_add_pd(
+                            _mm_mul_pd(vDistX, _mm_load_pd(&directionX[lane])),
+                            _mm_mul_pd(vDistY, _mm_load_pd(&directionY[lane]))),
+                            _mm_mul_pd(vDistZ, _mm_load_pd(&directionZ[lane])));
+                    __m128d dist2 = _mm_sub_pd(vLength2, _mm_mul_pd(projection, projection));
+                    __m128d hit = _mm_and_pd(_mm_cmpnlt_pd(projection, zero), _mm_cmpngt_pd(dist2, vRadius2));
+                    uint32_t mask = (uint32_t) _mm_movemask_pd(hit) & active;
+                    if (mask == 0) {
+                        continue;
+                    }
+                    __m128d close = _mm_sqrt_pd(_mm_sub_pd(vRadius2, dist2));
+                    __m128d tNear = _mm_sub_pd(projection, close);
+                    __m128d tFar = _mm_add_pd(projection, close);
+                    alignas(16) double ts[2];
+                    _mm_store_pd(ts, blend(tNear, tFar, _mm_cmplt_pd(tNear, zero)));
+                    for (uint32_t l = 0; l < 2; ++l) {
+                        if (mask & (1u << l)) {
+                            keepCloser(ts[l], i, pack._sphereIndex, packet._hits[lane + l]);
+                        }
+                    }
+                }
+            }
+#else
+            for (uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                if ((packet._activeMask & (1u << lane)) == 0) {
+                    continue;
+                }
+                Real d_projection = distX * directionX[lane] + distY * directionY[lane] + distZ * directionZ[lane];
+                if (d_projection < 0) {
+                    continue;
+                }
+                Real dist2;
+                if constexpr (std::is_same_v<Real, float>) {
+                    dist2 = perpendicularSquared(distX, distY, distZ, d_projection, directionX[lane], directionY[lane], directionZ[lane]);
+                } else {
+                    dist2 = length2 - d_projection * d_projection;
+                }
+                if (dist2 > radius2) {
+                    continue;
+                }
+                Real d_close = std::sqrt(radius2 - dist2);
+                Real t = d_projection - d_close;
+                if (t < 0) {
+                    t = d_projection + d_close;
+                }
+                keepCloser(t, i, pack._sphereIndex, packet._hits[lane]);
+            }
+#endif
+        }
+    }
+
+    // constant initialized, so it can be used before main() runs as well
+    extern const KernelSet kernels;
+    const KernelSet kernels = {
+            name,
+            SphereKernels<double>{RAYTRACE_KERNELS_BYTES == 0 ? 1 : RAYTRACE_KERNELS_BYTES / (uint32_t) sizeof(double), &intersect<double>, &occludes<double>, &intersectPacket<double>},
+            SphereKernels<float>{RAYTRACE_KERNELS_BYTES == 0 ? 1 : RAYTRACE_KERNELS_BYTES / (uint32_t) sizeof(float), &intersect<float>, &occludes<float>, &intersectPacket<float>}};
+}
+
+#undef RAYTRACE_KERNELS
+#undef RAYTRACE_KERNELS_BYTES
+#undef RAYTRACE_KERNELS_AVX512
+#undef RAYTRACE_KERNELS_AVX
+#undef RAYTRACE_KERNELS_SSE
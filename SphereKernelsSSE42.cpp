@@ -0,0 +1,5 @@
+
+
+// The sphere kernels compiled for SSE4.2, see SphereKernels.hpp. CMakeLists.txt gives this file the flags for it
+#define RAYTRACE_KERNELS sse42SphereKernels
+#include "SphereKernelsImpl.hpp"
@@ -0,0 +1,178 @@
+
+
+#include "SpherePack.hpp"
+
+#include <limits>
+
+namespace {
+    // a candidate hit at distance t on packed sphere index. Same rule as in Scene::intersect
+    inline void keepCloser(double t, uint32_t index, const ArrayStorage<uint32_t>& sphereIndex, Hit& best) {
+        if (best._index == SpherePack::noHit || t < best._t || (t == best._t && sphereIndex[index] < sphereIndex[best._index])) {
+            best._t = t;
+            best._index = index;
+        }
+    }
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials, std::span<const uint32_t> order) {
+    clear();
+    _size = (uint32_t) order.size();
+    // the coordinate arrays get padding unused entries at the end, so a SIMD load that starts at the last sphere
+    // never reads past the end of an array. The widest unmasked load is 32 bytes (AVX), AVX-512 masks its last one
+    uint32_t capacity = _size + padding;
+    std::vector<Real> centerX, centerY, centerZ, radiusSquared;
+    std::vector<uint32_t> sphereIndex, materialIndex;
+    centerX.reserve(capacity);
+    centerY.reserve(capacity);
+    centerZ.reserve(capacity);
+    radiusSquared.reserve(capacity);
+    sphereIndex.reserve(_size);
+    materialIndex.reserve(_size);
+    for (uint32_t index : order) {
+        const Sphere& sphere = spheres[index];
+        centerX.push_back((Real) sphere._center.x());
+        centerY.push_back((Real) sphere._center.y());
+        centerZ.push_back((Real) sphere._center.z());
+        radiusSquared.push_back((Real) (sphere._radius * sphere._radius));
+        sphereIndex.push_back(index);
+        materialIndex.push_back(sphere._material);
+    }
+    // padding entries can never be hit: every distance is > -infinity
+    for (uint32_t i = 0; i < padding; ++i) {
+        centerX.push_back(0.0);
+        centerY.push_back(0.0);
+        centerZ.push_back(0.0);
+        radiusSquared.push_back(-std::numeric_limits<Real>::infinity());
+    }
+    _centerX.assign(std::move(centerX));
+    _centerY.assign(std::move(centerY));
+    _centerZ.assign(std::move(centerZ));
+    _radiusSquared.assign(std::move(radiusSquared));
+    _sphereIndex.assign(std::move(sphereIndex));
+    _materialIndex.assign(std::move(materialIndex));
+    _materials.assign(std::vector<Material>(materials));
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::build(const BasicSpherePack<double>& source) {
+    clear();
+    typename BasicSpherePack<double>::Arrays arrays = source.getArrays();
+    _size = source.size();
+    auto convert = [&](std::span<const double> values) {
+        std::vector<Real> converted(_size + padding, (Real) 0);
+        for (uint32_t i = 0; i < _size; ++i) {
+            converted[i] = (Real) values[i];
+        }
+        return converted;
+    };
+    _centerX.assign(convert(arrays._centerX));
+    _centerY.assign(convert(arrays._centerY));
+    _centerZ.assign(convert(arrays._centerZ));
+    std::vector<Real> radiusSquared = convert(arrays._radiusSquared);
+    std::fill(radiusSquared.begin() + _size, radiusSquared.end(), -std::numeric_limits<Real>::infinity());
+    _radiusSquared.assign(std::move(radiusSquared));
+    _sphereIndex.assign(std::vector<uint32_t>(arrays._sphereIndex.begin(), arrays._sphereIndex.end()));
+    _materialIndex.assign(std::vector<uint32_t>(arrays._materialIndex.begin(), arrays._materialIndex.end()));
+    _materials.assign(std::vector<Material>(arrays._materials.begin(), arrays._materials.end()));
+}
+
+template<typename Real>
+typename BasicSpherePack<Real>::Arrays BasicSpherePack<Real>::getArrays() const {
+    return Arrays{_centerX.span(), _centerY.span(), _centerZ.span(), _radiusSquared.span(),
+                  _sphereIndex.span(), _materialIndex.span(), _materials.span()};
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::view(const Arrays& arrays) {
+    _size = (uint32_t) arrays._sphereIndex.size();
+    _centerX.view(arrays._centerX.data(), arrays._centerX.size());
+    _centerY.view(arrays._centerY.data(), arrays._centerY.size());
+    _centerZ.view(arrays._centerZ.data(), arrays._centerZ.size());
+    _radiusSquared.view(arrays._radiusSquared.data(), arrays._radiusSquared.size());
+    _sphereIndex.view(arrays._sphereIndex.data(), arrays._sphereIndex.size());
+    _materialIndex.view(arrays._materialIndex.data(), arrays._materialIndex.size());
+    _materials.view(arrays._materials.data(), arrays._materials.size());
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::clear() {
+    _centerX.clear();
+    _centerY.clear();
+    _centerZ.clear();
+    _radiusSquared.clear();
+    _sphereIndex.clear();
+    _materialIndex.clear();
+    _materials.clear();
+    _size = 0;
+}
+
+template<typename Real>
+uint32_t BasicSpherePack<Real>::size() const {
+    return _size;
+}
+
+template<typename Real>
+vec3 BasicSpherePack<Real>::getCenter(uint32_t index) const {
+    return vec3(_centerX[index], _centerY[index], _centerZ[index]);
+}
+
+template<typename Real>
+uint32_t BasicSpherePack<Real>::getSphereIndex(uint32_t index) const {
+    return _sphereIndex[index];
+}
+
+template<typename Real>
+const Material& BasicSpherePack<Real>::getMaterial(uint32_t index) const {
+    return _materials[_materialIndex[index]];
+}
+
+template<typename Real>
+PackedSpheres<Real> BasicSpherePack<Real>::packed() const {
+    return PackedSpheres<Real>{_centerX.data(), _centerY.data(), _centerZ.data(), _radiusSquared.data(),
+                               _sphereIndex.data(), _materialIndex.data(), _materials.data()};
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::intersect(const Ray& ray, uint32_t first, uint32_t count, Hit& best, uint32_t skip) const {
+    activeKernels().get<Real>()._intersect(packed(), ray, first, count, best, skip);
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::intersectScalar(const Ray& ray, uint32_t first, uint32_t count, Hit& best, uint32_t skip) const {
+    scalarKernels().get<Real>()._intersect(packed(), ray, first, count, best, skip);
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::intersectFromSurface(const Ray& ray, uint32_t index, Hit& best) const {
+    std::optional<double> t = ray.intersectsFromSurface(getCenter(index), (double) _radiusSquared[index]);
+    if (t.has_value()) {
+        keepCloser(*t, index, _sphereIndex, best);
+    }
+}
+
+template<typename Real>
+bool BasicSpherePack<Real>::occludes(const Ray& ray, uint32_t first, uint32_t count, double tMax, uint32_t skip) const {
+    return activeKernels().get<Real>()._occludes(packed(), ray, first, count, tMax, skip);
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::eyeRelative(const vec3& eye, std::vector<EyeRelativeSphere<Real>>& spheres) const {
+    // the same steps as at the start of the packet test (see SphereKernelsImpl.hpp), so the distances come out bit for bit the same
+    const Real o[3] = {(Real) eye[0], (Real) eye[1], (Real) eye[2]};
+    spheres.resize(_size);
+    for (uint32_t i = 0; i < _size; ++i) {
+        Real distX = _centerX[i] - o[0];
+        Real distY = _centerY[i] - o[1];
+        Real distZ = _centerZ[i] - o[2];
+        spheres[i] = EyeRelativeSphere<Real>{distX, distY, distZ, distX * distX + distY * distY + distZ * distZ, _radiusSquared[i]};
+    }
+}
+
+template<typename Real>
+void BasicSpherePack<Real>::intersect(RayPacket& packet, uint32_t first, uint32_t count, std::span<const EyeRelativeSphere<Real>> eye) const {
+    activeKernels().get<Real>()._intersectPacket(packed(), packet, first, count, eye.empty() ? nullptr : eye.data());
+}
+
+template class BasicSpherePack<double>;
+template class BasicSpherePack<float>;
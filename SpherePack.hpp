@@ -0,0 +1,95 @@
+
+
+#ifndef SPHEREPACK_HPP
+#define SPHEREPACK_HPP
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "ArrayStorage.hpp"
+#include "Material.hpp"
+#include "Ray.hpp"
+#include "RayPacket.hpp"
+#include "Sphere.hpp"
+#include "SphereKernels.hpp"
+#include "Vector3.hpp"
+
+// The spheres of a scene in structure-of-arrays form: one array per coordinate of the center, one for the squared
+// radius. The intersection test only needs these four numbers, and with separate arrays consecutive spheres sit next
+// to each other in memory, so one SIMD load fetches the same coordinate of several spheres at once.
+// The materials are kept apart from the geometry and are only looked at once the closest hit is known.
+// The tests themselves are in SphereKernelsImpl.hpp, compiled for several instruction sets; the pack calls whichever
+// activeKernels() says.
+//
+// Real is the type the coordinates are stored and intersected in. SpherePack (double) gives exactly the distances of
+// Ray::intersects. SpherePackF (float) takes half the memory and fits twice as many spheres into a SIMD register,
+// but its distances are only as precise as a float; see Scene::build for when it's used.
+template<typename Real>
+class BasicSpherePack {
+    ArrayStorage<Real> _centerX;
+    ArrayStorage<Real> _centerY;
+    ArrayStorage<Real> _centerZ;
+    ArrayStorage<Real> _radiusSquared;
+    ArrayStorage<uint32_t> _sphereIndex;   // position of the sphere in Scene::spheres
+    ArrayStorage<uint32_t> _materialIndex; // position of its material in _materials
+    ArrayStorage<Material> _materials;     // a copy of the scene's material table
+    uint32_t _size = 0;
+
+    // what the kernels (SphereKernels.hpp) are handed
+    PackedSpheres<Real> packed() const;
+public:
+    static constexpr uint32_t noHit = UINT32_MAX;
+    // unused entries at the end of the coordinate arrays, see build(). The widest unmasked SIMD load is 32 bytes
+    static constexpr uint32_t padding = 32 / sizeof(Real) - 1;
+
+    // all arrays at once, for storing a built pack somewhere (SceneCache) and using it from there again.
+    // The coordinate arrays are size + padding long, _materials is the material table
+    struct Arrays {
+        std::span<const Real> _centerX;
+        std::span<const Real> _centerY;
+        std::span<const Real> _centerZ;
+        std::span<const Real> _radiusSquared;
+        std::span<const uint32_t> _sphereIndex;
+        std::span<const uint32_t> _materialIndex;
+        std::span<const Material> _materials;
+    };
+
+    // packs spheres[order[0]], spheres[order[1]], ... so that pack entry i is sphere order[i]. The spheres' material
+    // indices point into materials
+    void build(const std::vector<Sphere>& spheres, const std::vector<Material>& materials, std::span<const uint32_t> order);
+    // the same spheres in the same order as a double pack, converted to Real. Works for packs that view a cache too
+    void build(const BasicSpherePack<double>& source);
+    Arrays getArrays() const;
+    // uses arrays that live elsewhere (a mapped scene cache) instead of building them
+    void view(const Arrays& arrays);
+    void clear();
+    uint32_t size() const;
+
+    // Tests the ray against the packed spheres [first, first + count) and updates best (_index is an index into this
+    // pack, noHit if nothing has been hit yet) if one of them is closer. Gives the same t as Ray::intersects (up to
+    // the precision of Real), and on equal distances prefers the sphere with the lower index in Scene::spheres.
+    // The sphere skip (an index into this pack) is left out, see intersectFromSurface
+    void intersect(const Ray& ray, uint32_t first, uint32_t count, Hit& best, uint32_t skip = noHit) const;
+    // the same with the plain scalar code, one sphere at a time, whatever activeKernels() is
+    void intersectScalar(const Ray& ray, uint32_t first, uint32_t count, Hit& best, uint32_t skip = noHit) const;
+    // For a ray that starts on the surface of sphere index: updates best with where it hits that sphere again, if
+    // it does (see Ray::intersectsFromSurface). Always in double. The other spheres are then tested with skip = index
+    void intersectFromSurface(const Ray& ray, uint32_t index, Hit& best) const;
+    // the same for every active ray of a packet, updating packet._hits. Here the SIMD lanes hold rays, not spheres.
+    // eye is either empty or eyeRelative(packet._origin), which saves working out the per sphere part every time
+    void intersect(RayPacket& packet, uint32_t first, uint32_t count, std::span<const EyeRelativeSphere<Real>> eye = {}) const;
+    // every sphere of the pack as seen from eye, in pack order
+    void eyeRelative(const vec3& eye, std::vector<EyeRelativeSphere<Real>>& spheres) const;
+    // true as soon as any shadow casting sphere in the range but skip is hit closer than tMax
+    bool occludes(const Ray& ray, uint32_t first, uint32_t count, double tMax, uint32_t skip = noHit) const;
+
+    vec3 getCenter(uint32_t index) const;
+    uint32_t getSphereIndex(uint32_t index) const;
+    const Material& getMaterial(uint32_t index) const;
+};
+
+using SpherePack = BasicSpherePack<double>;
+using SpherePackF = BasicSpherePack<float>;
+
+#endif //SPHEREPACK_HPP
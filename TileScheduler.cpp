@@ -0,0 +1,100 @@
+
+
+#include "TileScheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace {
+    // one per worker. alignas keeps the counters of different workers out of each other's cache lines
+    struct alignas(64) WorkQueue {
+        std::atomic<uint64_t> _next{0};
+        uint64_t _end = 0;
+    };
+
+    unsigned defaultThreadCount() {
+        unsigned count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+}
+
+TileScheduler::TileScheduler() : _tileWidth(32), _tileHeight(32), _threadCount(defaultThreadCount()) {}
+
+TileScheduler::TileScheduler(uint64_t tileWidth, uint64_t tileHeight, unsigned threadCount)
+    : _tileWidth(std::max<uint64_t>(tileWidth, 1)), _tileHeight(std::max<uint64_t>(tileHeight, 1)),
+      _threadCount(threadCount == 0 ? defaultThreadCount() : threadCount) {}
+
+void TileScheduler::setTileSize(uint64_t tileWidth, uint64_t tileHeight) {
+    _tileWidth = std::max<uint64_t>(tileWidth, 1);
+    _tileHeight = std::max<uint64_t>(tileHeight, 1);
+}
+
+void TileScheduler::setThreadCount(unsigned threadCount) {
+    _threadCount = threadCount == 0 ? defaultThreadCount() : threadCount;  // 0 means "use all cores"
+}
+
+uint64_t TileScheduler::getTileWidth() const {
+    return _tileWidth;
+}
+
+uint64_t TileScheduler::getTileHeight() const {
+    return _tileHeight;
+}
+
+unsigned TileScheduler::getThreadCount() const {
+    return _threadCount;
+}
+
+std::vector<Tile> TileScheduler::makeTiles(uint64_t width, uint64_t height) const {
+    std::vector<Tile> tiles;
+    tiles.reserve(((width + _tileWidth - 1) / _tileWidth) * ((height + _tileHeight - 1) / _tileHeight));
+    for (uint64_t y = 0; y < height; y += _tileHeight) {
+        for (uint64_t x = 0; x < width; x += _tileWidth) {
+            tiles.push_back(Tile{x, y, std::min(x + _tileWidth, width), std::min(y + _tileHeight, height)});
+        }
+    }
+    return tiles;
+}
+
+void TileScheduler::run(uint64_t taskCount, const std::function<void(uint64_t task, unsigned worker)>& work) const {
+    unsigned workers = (unsigned) std::min<uint64_t>(_threadCount, taskCount);
+    if (workers <= 1) {
+        // the serial path, nothing to schedule
+        for (uint64_t task = 0; task < taskCount; ++task) {
+            work(task, 0);
+        }
+        return;
+    }
+
+    // every worker starts with an equal, contiguous share of the tasks. Neighbouring tiles touch neighbouring
+    // memory in the Screen, so handing out contiguous ranges keeps the writes of one worker close together
+    std::unique_ptr<WorkQueue[]> queues(new WorkQueue[workers]);
+    for (unsigned w = 0; w < workers; ++w) {
+        queues[w]._next.store(taskCount * w / workers, std::memory_order_relaxed);
+        queues[w]._end = taskCount * (w + 1) / workers;
+    }
+
+    auto worker = [&](unsigned self) {
+        // drain our own queue first, then visit the others and take whatever is left there.
+        // fetch_add hands every index out exactly once, no matter how many workers pull from the same queue
+        for (unsigned i = 0; i < workers; ++i) {
+            WorkQueue& queue = queues[(self + i) % workers];
+            for (uint64_t task = queue._next.fetch_add(1, std::memory_order_relaxed); task < queue._end;
+                 task = queue._next.fetch_add(1, std::memory_order_relaxed)) {
+                work(task, self);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+    for (unsigned w = 1; w < workers; ++w) {
+        threads.emplace_back(worker, w);
+    }
+    worker(0);  // the calling thread works as well instead of just waiting
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,42 @@
+
+
+#ifndef TILESCHEDULER_HPP
+#define TILESCHEDULER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// A rectangular block of pixels [_x0,_x1) x [_y0,_y1) that one worker renders in one go.
+struct Tile {
+    uint64_t _x0;
+    uint64_t _y0;
+    uint64_t _x1;
+    uint64_t _y1;
+};
+
+// Splits work into tasks and hands them to a group of worker threads. Every worker owns a contiguous slice
+// of the task list, and once its own slice is empty it steals the remaining tasks of the other workers.
+// Tasks never share pixels, so results can be written into the Screen without any locking.
+class TileScheduler {
+    uint64_t _tileWidth;
+    uint64_t _tileHeight;
+    unsigned _threadCount;
+public:
+    TileScheduler();
+    TileScheduler(uint64_t tileWidth, uint64_t tileHeight, unsigned threadCount);
+
+    void setTileSize(uint64_t tileWidth, uint64_t tileHeight);
+    void setThreadCount(unsigned threadCount);
+    uint64_t getTileWidth() const;
+    uint64_t getTileHeight() const;
+    unsigned getThreadCount() const;
+
+    // tiles in row-major order, the ones at the right and bottom border may be smaller
+    std::vector<Tile> makeTiles(uint64_t width, uint64_t height) const;
+
+    // calls work(task, worker) exactly once for every task in [0, taskCount). worker is in [0, getThreadCount())
+    void run(uint64_t taskCount, const std::function<void(uint64_t task, unsigned worker)>& work) const;
+};
+
+#endif //TILESCHEDULER_HPP
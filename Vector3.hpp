@@ -6,58 +6,157 @@
 #include <cmath>
 #include <iostream>
 #include <optional>
+#include <type_traits>
 
-struct vec3 {
+// Everything in here is defined in the header and is inline/constexpr, so the compiler sees through every operator
+// and can keep the vectors in registers, instead of making a function call for every + and * in the hot loops.
+// The scalar type is a template parameter: vec3 is the double version we render with, vec3f the float one.
+template<typename T>
+struct basic_vec3 {
 public:
-    double _elements[3];
-
-    vec3();
-    vec3(double x, double y, double z);
-
-    double x() const;
-    double y() const;
-    double z() const;
-
-    vec3 operator-() const;
-    double operator[](int i) const;
-    double& operator[](int i);
-
-    vec3& operator+=(const vec3& v);
-
-    vec3& operator*=(double t);
-
-    vec3& operator/=(double t);
-
-    double length() const;
-
-    double length_squared() const;
-
-    vec3 reflection(const vec3& normal) const;
-    std::optional<vec3> refraction(const vec3& normal, double IORRatio) const;
-    void clamp(double min, double max);
+    T _elements[3];
+
+    constexpr basic_vec3() : _elements{0, 0, 0} {}
+    constexpr basic_vec3(T x, T y, T z) : _elements{x, y, z} {}
+
+    constexpr T x() const { return _elements[0]; }
+    constexpr T y() const { return _elements[1]; }
+    constexpr T z() const { return _elements[2]; }
+
+    //returns a vector where each of the elements is flipped from positive to negative and vice versa
+    constexpr basic_vec3 operator-() const {
+        return basic_vec3{-_elements[0], -_elements[1], -_elements[2]};
+    }
+
+    // return the i-th element of the elements vector
+    constexpr T operator[](int i) const { return _elements[i]; }
+    constexpr T& operator[](int i) { return _elements[i]; }
+
+    constexpr basic_vec3& operator+=(const basic_vec3& v) {
+        _elements[0] += v._elements[0];
+        _elements[1] += v._elements[1];
+        _elements[2] += v._elements[2];
+        return *this;
+    }
+
+    constexpr basic_vec3& operator*=(T t) {
+        _elements[0] *= t;
+        _elements[1] *= t;
+        _elements[2] *= t;
+        return *this;
+    }
+
+    constexpr basic_vec3& operator/=(T t) {
+        return *this *= 1 / t;
+    }
+
+    // Return the length of the vector
+    T length() const {
+        return std::sqrt(length_squared());
+    }
+
+    // Return the length but squared
+    constexpr T length_squared() const {
+        return _elements[0] * _elements[0] + _elements[1] * _elements[1] + _elements[2] * _elements[2];
+    }
+
+    constexpr basic_vec3 reflection(const basic_vec3& normal) const;
+    std::optional<basic_vec3> refraction(const basic_vec3& normal, T IORRatio) const;
+
+    constexpr void clamp(T min, T max) {
+        for (T& element : _elements) {
+            if (element < min) {
+                element = min;
+            }
+            if (element > max) {
+                element = max;
+            }
+        }
+    }
 };
 
-std::ostream& operator<<(std::ostream& out, const vec3& v);
-
-vec3 operator+(const vec3& u, const vec3& v);
-
-vec3 operator-(const vec3& u, const vec3& v);
-
-vec3 operator*(const vec3& u, const vec3& v);
-
-vec3 operator*(double t, const vec3& v);
-
-vec3 operator*(const vec3& v, double t);
-
-vec3 operator/(const vec3& v, double t);
-
-double dot(const vec3& u, const vec3& v);
-
-vec3 cross(const vec3& u, const vec3& v);
-
-vec3 unit_vector(const vec3& v);
-
-
-
+using vec3 = basic_vec3<double>;
+using vec3f = basic_vec3<float>;
+
+template<typename T>
+std::ostream& operator<<(std::ostream& out, const basic_vec3<T>& v) {
+    return out << v._elements[0] << ' ' << v._elements[1] << ' ' << v._elements[2];
+}
+
+template<typename T>
+constexpr basic_vec3<T> operator+(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u._elements[0] + v._elements[0], u._elements[1] + v._elements[1], u._elements[2] + v._elements[2]);
+}
+
+template<typename T>
+constexpr basic_vec3<T> operator-(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u._elements[0] - v._elements[0], u._elements[1] - v._elements[1], u._elements[2] - v._elements[2]);
+}
+
+template<typename T>
+constexpr basic_vec3<T> operator*(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u._elements[0] * v._elements[0], u._elements[1] * v._elements[1], u._elements[2] * v._elements[2]);
+}
+
+// To scale a number with a vector. type_identity_t keeps e.g. 2 * v working: the scalar takes the vector's type
+// instead of taking part in the template argument deduction
+template<typename T>
+constexpr basic_vec3<T> operator*(std::type_identity_t<T> t, const basic_vec3<T>& v) {
+    return basic_vec3<T>(t * v._elements[0], t * v._elements[1], t * v._elements[2]);
+}
+
+// To scale a vector with a number
+template<typename T>
+constexpr basic_vec3<T> operator*(const basic_vec3<T>& v, std::type_identity_t<T> t) {
+    return t * v;
+}
+
+// To divide a vector by a number
+template<typename T>
+constexpr basic_vec3<T> operator/(const basic_vec3<T>& v, std::type_identity_t<T> t) {
+    return (1 / t) * v;
+}
+
+// dot product of a vector
+template<typename T>
+constexpr T dot(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+}
+
+// cross product of a vector
+template<typename T>
+constexpr basic_vec3<T> cross(const basic_vec3<T>& u, const basic_vec3<T>& v) {
+    return basic_vec3<T>(u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]);
+}
+
+// To normalize a vector such that it has a length of 1, we need to divide a vector by its length
+template<typename T>
+inline basic_vec3<T> unit_vector(const basic_vec3<T>& v) {
+    return v / v.length();
+}
+
+//explanation for reflection and refraction logic: https://www.scratchapixel.com/lessons/3d-basic-rendering/introduction-to-shading/reflection-refraction-fresnel.html
+template<typename T>
+constexpr basic_vec3<T> basic_vec3<T>::reflection(const basic_vec3<T>& normal) const {
+
+    // The surface normal(it's the axis at which the ray is reflected) and incident direction are essential components for computing reflected ray direction
+
+    // we use the formula: " R = I - 2 * (I · N) * N " from the given link above
+
+    return *this - 2 * dot(*this, normal) * normal; //  *this represents  incident direction (ray._direction), normal represents the intersection->_normal;
+}
+
+template<typename T>
+inline std::optional<basic_vec3<T>> basic_vec3<T>::refraction(const basic_vec3<T>& normal, T IORRatio) const //called in Scene::traceRay
+{
+    T cosI = dot(*this, normal);
+    int sign = (cosI < 0) ? -1 : 1;
+    T n = (sign == 1) ? IORRatio : 1 / IORRatio;
+    T sinT2 = n * n * (1 - cosI * cosI);
+    if (sinT2 > 1) {
+        return {};
+    }
+    return *this * n - normal * (n * cosI - sign * std::sqrt(1 - sinT2));
+}
 
 #endif //VECTOR3_HPP
@@ -0,0 +1,338 @@
+
+
+#ifndef VECTOR3X_HPP
+#define VECTOR3X_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+#include "Vector3.hpp"
+
+// N vectors at once, for code that handles several rays together (RayPacket, ray generation). vec3 keeps its three
+// numbers next to each other, so a loop over rays works on one vec3 after the other and the compiler can't put the
+// rays side by side into SIMD lanes. basic_vec3x stores them the other way round, one array per coordinate, so every
+// operation here is a loop over N lanes doing the same thing, which the compiler turns into SIMD instructions for
+// whatever the file is compiled for.
+//
+// Every function does what its vec3 namesake in Vector3.hpp does, in the same order, so lane i comes out bit for bit
+// the same as the scalar code would compute for vector i (given no fused multiply-adds, see CMakeLists.txt).
+//
+// Lanes are selected with masks, bit i for lane i, the way RayPacket::_activeMask does it; so N is at most 32.
+
+// N numbers, one per lane: what dot() and length() give for N vectors
+template<typename T, uint32_t N>
+struct lanes {
+    static_assert(N > 0 && N <= 32 && (N & (N - 1)) == 0, "a power of two, and lane masks are 32 bit");
+    alignas(N * sizeof(T) >= 64 ? 64 : N * sizeof(T)) T _values[N];
+
+    constexpr lanes() : _values{} {}
+    // the same value in every lane
+    constexpr explicit lanes(T value) {
+        for (uint32_t i = 0; i < N; ++i) {
+            _values[i] = value;
+        }
+    }
+
+    constexpr T operator[](uint32_t i) const { return _values[i]; }
+    constexpr T& operator[](uint32_t i) { return _values[i]; }
+
+    static constexpr lanes load(const T* values) {
+        lanes result;
+        for (uint32_t i = 0; i < N; ++i) {
+            result._values[i] = values[i];
+        }
+        return result;
+    }
+
+    constexpr void store(T* values) const {
+        for (uint32_t i = 0; i < N; ++i) {
+            values[i] = _values[i];
+        }
+    }
+
+    // only the lanes in mask are written
+    constexpr void store(uint32_t mask, T* values) const {
+        for (uint32_t i = 0; i < N; ++i) {
+            if (mask & (1u << i)) {
+                values[i] = _values[i];
+            }
+        }
+    }
+
+    constexpr lanes operator-() const {
+        lanes result;
+        for (uint32_t i = 0; i < N; ++i) {
+            result._values[i] = -_values[i];
+        }
+        return result;
+    }
+};
+
+using doublex4 = lanes<double, 4>;
+using doublex8 = lanes<double, 8>;
+using floatx8 = lanes<float, 8>;
+
+// a(i) op b(i) for every lane i; what all the operators and comparisons below are made of
+template<typename T, uint32_t N, typename Op>
+constexpr lanes<T, N> perLane(const lanes<T, N>& a, const lanes<T, N>& b, Op op) {
+    lanes<T, N> result;
+    for (uint32_t i = 0; i < N; ++i) {
+        result._values[i] = op(a._values[i], b._values[i]);
+    }
+    return result;
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator+(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return perLane(a, b, [](T x, T y) { return x + y; });
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator+(std::type_identity_t<T> a, const lanes<T, N>& b) {
+    return lanes<T, N>(a) + b;
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator+(const lanes<T, N>& a, std::type_identity_t<T> b) {
+    return a + lanes<T, N>(b);
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator-(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return perLane(a, b, [](T x, T y) { return x - y; });
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator-(std::type_identity_t<T> a, const lanes<T, N>& b) {
+    return lanes<T, N>(a) - b;
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator-(const lanes<T, N>& a, std::type_identity_t<T> b) {
+    return a - lanes<T, N>(b);
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator*(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return perLane(a, b, [](T x, T y) { return x * y; });
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator*(std::type_identity_t<T> a, const lanes<T, N>& b) {
+    return lanes<T, N>(a) * b;
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator*(const lanes<T, N>& a, std::type_identity_t<T> b) {
+    return a * lanes<T, N>(b);
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator/(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return perLane(a, b, [](T x, T y) { return x / y; });
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator/(std::type_identity_t<T> a, const lanes<T, N>& b) {
+    return lanes<T, N>(a) / b;
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> operator/(const lanes<T, N>& a, std::type_identity_t<T> b) {
+    return a / lanes<T, N>(b);
+}
+
+// Comparisons give the mask of the lanes where they hold. As with the scalar operators, a NaN compares false
+template<typename T, uint32_t N, typename Compare>
+constexpr uint32_t maskOf(const lanes<T, N>& a, const lanes<T, N>& b, Compare compare) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < N; ++i) {
+        mask |= (uint32_t) compare(a._values[i], b._values[i]) << i;
+    }
+    return mask;
+}
+
+template<typename T, uint32_t N>
+constexpr uint32_t less(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return maskOf(a, b, [](T x, T y) { return x < y; });
+}
+
+template<typename T, uint32_t N>
+constexpr uint32_t lessEqual(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return maskOf(a, b, [](T x, T y) { return x <= y; });
+}
+
+template<typename T, uint32_t N>
+constexpr uint32_t greater(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return maskOf(a, b, [](T x, T y) { return x > y; });
+}
+
+template<typename T, uint32_t N>
+constexpr uint32_t greaterEqual(const lanes<T, N>& a, const lanes<T, N>& b) {
+    return maskOf(a, b, [](T x, T y) { return x >= y; });
+}
+
+// all N lanes
+template<uint32_t N>
+constexpr uint32_t allLanes() {
+    return N == 32 ? UINT32_MAX : (1u << N) - 1;
+}
+
+// per lane: mask ? ifSet : ifClear
+template<typename T, uint32_t N>
+constexpr lanes<T, N> where(uint32_t mask, const lanes<T, N>& ifSet, const lanes<T, N>& ifClear) {
+    lanes<T, N> result;
+    for (uint32_t i = 0; i < N; ++i) {
+        result._values[i] = (mask & (1u << i)) ? ifSet._values[i] : ifClear._values[i];
+    }
+    return result;
+}
+
+template<typename T, uint32_t N>
+inline lanes<T, N> sqrt(const lanes<T, N>& a) {
+    lanes<T, N> result;
+    for (uint32_t i = 0; i < N; ++i) {
+        result._values[i] = std::sqrt(a._values[i]);
+    }
+    return result;
+}
+
+template<typename T, uint32_t N>
+struct basic_vec3x {
+    lanes<T, N> _x, _y, _z;
+
+    constexpr basic_vec3x() = default;
+    constexpr basic_vec3x(const lanes<T, N>& x, const lanes<T, N>& y, const lanes<T, N>& z) : _x(x), _y(y), _z(z) {}
+    // v in every lane
+    constexpr explicit basic_vec3x(const basic_vec3<T>& v) : _x(v.x()), _y(v.y()), _z(v.z()) {}
+
+    // from and to one array per coordinate, like RayPacket and SpherePack keep them
+    static constexpr basic_vec3x load(const T* x, const T* y, const T* z) {
+        return basic_vec3x(lanes<T, N>::load(x), lanes<T, N>::load(y), lanes<T, N>::load(z));
+    }
+
+    // the lanes in mask only
+    constexpr void store(uint32_t mask, T* x, T* y, T* z) const {
+        _x.store(mask, x);
+        _y.store(mask, y);
+        _z.store(mask, z);
+    }
+
+    constexpr basic_vec3<T> get(uint32_t lane) const {
+        return basic_vec3<T>(_x[lane], _y[lane], _z[lane]);
+    }
+
+    constexpr void set(uint32_t lane, const basic_vec3<T>& v) {
+        _x[lane] = v.x();
+        _y[lane] = v.y();
+        _z[lane] = v.z();
+    }
+
+    constexpr basic_vec3x operator-() const {
+        return basic_vec3x(-_x, -_y, -_z);
+    }
+
+    lanes<T, N> length() const {
+        return sqrt(length_squared());
+    }
+
+    constexpr lanes<T, N> length_squared() const {
+        return _x * _x + _y * _y + _z * _z;
+    }
+
+    constexpr basic_vec3x reflection(const basic_vec3x& normal) const;
+    // Where a lane refracts, its bit is set in refracted and the lane holds the refracted direction; where vec3's
+    // refraction gives nothing (total internal reflection) the lane is the zero vector
+    basic_vec3x refraction(const basic_vec3x& normal, const lanes<T, N>& IORRatio, uint32_t& refracted) const;
+};
+
+using vec3x4 = basic_vec3x<double, 4>;
+using vec3x8 = basic_vec3x<double, 8>;
+using vec3fx8 = basic_vec3x<float, 8>;
+
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator+(const basic_vec3x<T, N>& u, const basic_vec3x<T, N>& v) {
+    return basic_vec3x<T, N>(u._x + v._x, u._y + v._y, u._z + v._z);
+}
+
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator-(const basic_vec3x<T, N>& u, const basic_vec3x<T, N>& v) {
+    return basic_vec3x<T, N>(u._x - v._x, u._y - v._y, u._z - v._z);
+}
+
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator*(const basic_vec3x<T, N>& u, const basic_vec3x<T, N>& v) {
+    return basic_vec3x<T, N>(u._x * v._x, u._y * v._y, u._z * v._z);
+}
+
+// every lane scaled by its own number
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator*(const lanes<T, N>& t, const basic_vec3x<T, N>& v) {
+    return basic_vec3x<T, N>(t * v._x, t * v._y, t * v._z);
+}
+
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator*(const basic_vec3x<T, N>& v, const lanes<T, N>& t) {
+    return t * v;
+}
+
+// all lanes scaled by the same number
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator*(std::type_identity_t<T> t, const basic_vec3x<T, N>& v) {
+    return lanes<T, N>(t) * v;
+}
+
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator*(const basic_vec3x<T, N>& v, std::type_identity_t<T> t) {
+    return t * v;
+}
+
+// as for vec3, a division is a multiplication with the inverse
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> operator/(const basic_vec3x<T, N>& v, const lanes<T, N>& t) {
+    return (1 / t) * v;
+}
+
+template<typename T, uint32_t N>
+constexpr lanes<T, N> dot(const basic_vec3x<T, N>& u, const basic_vec3x<T, N>& v) {
+    return u._x * v._x + u._y * v._y + u._z * v._z;
+}
+
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> cross(const basic_vec3x<T, N>& u, const basic_vec3x<T, N>& v) {
+    return basic_vec3x<T, N>(u._y * v._z - u._z * v._y, u._z * v._x - u._x * v._z, u._x * v._y - u._y * v._x);
+}
+
+template<typename T, uint32_t N>
+inline basic_vec3x<T, N> unit_vector(const basic_vec3x<T, N>& v) {
+    return v / v.length();
+}
+
+// per lane: mask ? ifSet : ifClear
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> where(uint32_t mask, const basic_vec3x<T, N>& ifSet, const basic_vec3x<T, N>& ifClear) {
+    return basic_vec3x<T, N>(where(mask, ifSet._x, ifClear._x), where(mask, ifSet._y, ifClear._y), where(mask, ifSet._z, ifClear._z));
+}
+
+// R = I - 2 * (I · N) * N, see vec3::reflection
+template<typename T, uint32_t N>
+constexpr basic_vec3x<T, N> basic_vec3x<T, N>::reflection(const basic_vec3x<T, N>& normal) const {
+    return *this - 2 * dot(*this, normal) * normal;
+}
+
+// vec3::refraction for every lane at once. Instead of returning early, the lanes with total internal reflection
+// compute a NaN that is then replaced by zero
+template<typename T, uint32_t N>
+inline basic_vec3x<T, N> basic_vec3x<T, N>::refraction(const basic_vec3x<T, N>& normal, const lanes<T, N>& IORRatio, uint32_t& refracted) const {
+    lanes<T, N> cosI = dot(*this, normal);
+    uint32_t entering = less(cosI, lanes<T, N>(0));
+    lanes<T, N> sign = where(entering, lanes<T, N>(-1), lanes<T, N>(1));
+    lanes<T, N> n = where(entering, 1 / IORRatio, IORRatio);
+    lanes<T, N> sinT2 = n * n * (1 - cosI * cosI);
+    refracted = ~greater(sinT2, lanes<T, N>(1)) & allLanes<N>();
+    basic_vec3x<T, N> direction = *this * n - normal * (n * cosI - sign * sqrt(1 - sinT2));
+    return where(refracted, direction, basic_vec3x<T, N>());
+}
+
+#endif //VECTOR3X_HPP
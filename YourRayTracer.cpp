@@ -3,10 +3,14 @@
 
 #include "YourRayTracer.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+
 #include "Ray.hpp"
 
 
-RaySetup YourRayTracer::computeRaySetup(const Screen screen) {
+RaySetup YourRayTracer::computeRaySetup(const Screen& screen) const {
     RaySetup rs;
     vec3 forwardDir = _camera.getViewDir();
     vec3 upDir = _camera.getUpDir();
@@ -27,28 +31,215 @@ void YourRayTracer::setCamera(Camera& camera) {
     this->_camera = camera;
 }
 
-void YourRayTracer::setScene(Scene& scene) {
-    this->_scene = scene;
+void YourRayTracer::setScene(const Scene& scene) {
+    std::shared_ptr<Scene> copy = std::make_shared<Scene>(scene);
+    copy->build();
+    this->_scene = std::move(copy);
+}
+
+void YourRayTracer::setScene(std::shared_ptr<const Scene> scene) {
+    this->_scene = std::move(scene);
+}
+
+const Scene& YourRayTracer::getScene() const {
+    return *_scene;
+}
+
+template<typename Real>
+void YourRayTracer::prepareScene() {
+    if (!_scene->isBuilt<Real>()) {
+        // The scene is const, and others may be rendering it right now, so it can't be built in place. A built
+        // copy is the only way; it's kept, so this happens once
+        std::shared_ptr<Scene> built = std::make_shared<Scene>(*_scene);
+        built->build<Real>();
+        _scene = std::move(built);
+    }
+}
+
+void YourRayTracer::setTileScheduler(const TileScheduler& scheduler) {
+    this->_scheduler = scheduler;
+}
+
+void YourRayTracer::setPacketTracing(bool packetTracing) {
+    this->_packetTracing = packetTracing;
+}
+
+void YourRayTracer::setProgressiveStep(uint64_t coarsestStep) {
+    this->_coarsestStep = std::bit_floor(std::max<uint64_t>(coarsestStep, 1));
+}
+
+template<typename Real>
+void YourRayTracer::render(Screen& screen, const RowsCallback& onRowsDone) {
+    prepareScene<Real>();
+    RaySetup rs = computeRaySetup(screen);
+    // The screen is cut into tiles which the scheduler spreads over all cores. Every pixel is still computed by
+    // exactly the same code as before, so the image doesn't depend on the number of threads or the tile size
+    std::vector<Tile> tiles = _scheduler.makeTiles(screen.getWidth(), screen.getHeight());
+    // Packets need the BVH, which prepareScene makes sure of (unless there are no spheres at all)
+    bool packets = _packetTracing && !_scene->bvh.empty();
+    // all primary rays start at the eye, so what the sphere tests need of the eye is worked out once for the frame
+    std::vector<EyeRelativeSphere<Real>> eye;
+    if (packets) {
+        _scene->getPack<Real>().eyeRelative(rs._rayOrigin, eye);
+    }
+    // every worker adds up what its tiles traced in its own slot, they're summed up at the end
+    std::vector<RayCounters> workerCounters(_scheduler.getThreadCount());
+    // tiles still to do per row of tiles. Whoever renders the last tile of a row reports the row as done; the
+    // acq_rel makes the pixels the other workers wrote into that row visible to it
+    uint64_t tilesPerRow = (screen.getWidth() + _scheduler.getTileWidth() - 1) / _scheduler.getTileWidth();
+    std::vector<std::atomic<uint64_t>> tilesLeft(tilesPerRow == 0 ? 0 : tiles.size() / tilesPerRow);
+    for (auto& left : tilesLeft) {
+        left.store(tilesPerRow, std::memory_order_relaxed);
+    }
+    _scheduler.run(tiles.size(), [&](uint64_t task, unsigned worker) {
+        RayCounters before = Scene::threadCounters();
+        if (packets) {
+            renderTilePackets<Real>(screen, tiles[task], rs, eye);
+        } else {
+            renderTile<Real>(screen, tiles[task], rs);
+        }
+        workerCounters[worker] += Scene::threadCounters() - before;
+        if (onRowsDone && tilesLeft[task / tilesPerRow].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            onRowsDone(tiles[task]._y0, tiles[task]._y1);
+        }
+    });
+    _counters = RayCounters();
+    for (const RayCounters& counters : workerCounters) {
+        _counters += counters;
+    }
+    _counters._primary = screen.getWidth() * screen.getHeight();
 }
 
-void YourRayTracer::render(Screen& screen) {
+template<typename Real>
+void YourRayTracer::renderProgressive(Screen& screen, const PassCallback& onPass) {
+    prepareScene<Real>();
+    // Coarse to fine: the first pass traces one pixel out of every _coarsestStep x _coarsestStep block and paints
+    // the whole block with it, every following pass halves the step and only traces the pixels that the passes
+    // before haven't traced yet. After the last pass (step 1) every pixel has been traced exactly once, with the
+    // same ray as render() would use, so the final image is the same; in between there's always a full preview.
     RaySetup rs = computeRaySetup(screen);
-    for(uint64_t y = 0; y < screen.getHeight(); ++y) {
-        for(uint64_t x = 0; x < screen.getWidth(); ++x) {
+    std::vector<Tile> tiles = _scheduler.makeTiles(screen.getWidth(), screen.getHeight());
+    std::vector<RayCounters> workerCounters(_scheduler.getThreadCount());
+    unsigned passCount = std::countr_zero(_coarsestStep) + 1;
+    for (unsigned pass = 0; pass < passCount; ++pass) {
+        uint64_t step = _coarsestStep >> pass;
+        _scheduler.run(tiles.size(), [&](uint64_t task, unsigned worker) {
+            RayCounters before = Scene::threadCounters();
+            renderTilePass<Real>(screen, tiles[task], rs, step, pass == 0);
+            workerCounters[worker] += Scene::threadCounters() - before;
+        });
+        if (!onPass(screen, pass, passCount)) {
+            break;
+        }
+    }
+    _counters = RayCounters();
+    for (const RayCounters& counters : workerCounters) {
+        _counters += counters;
+    }
+}
+
+const RayCounters& YourRayTracer::getRayCounters() const {
+    return _counters;
+}
+
+template<typename Real>
+void YourRayTracer::renderTile(Screen& screen, const Tile& tile, const RaySetup& rs) const {
+    for(uint64_t y = tile._y0; y < tile._y1; ++y) {
+        for(uint64_t x = tile._x0; x < tile._x1; ++x) {
             vec3 color;
             Ray r = computeRay(x,y,rs);
-            color = traceRay(r);
-            screen.setPixel(x, y, color);
+            color = traceRay<Real>(r);
+            screen.setPixel(x, y, color); // tiles never overlap, so no two threads write the same pixel
+        }
+    }
+}
+
+template<typename Real>
+void YourRayTracer::renderTilePackets(Screen& screen, const Tile& tile, const RaySetup& rs, std::span<const EyeRelativeSphere<Real>> eye) const {
+    // The primary rays of each 4x4 block of pixels are intersected together as one RayPacket. Only the first hit
+    // is shared work, the shading (and with it all reflection/refraction rays) is done per pixel as before.
+    // Pixels of a block that fall outside the tile stay as inactive lanes.
+    for(uint64_t y0 = tile._y0; y0 < tile._y1; y0 += RayPacket::height) {
+        for(uint64_t x0 = tile._x0; x0 < tile._x1; x0 += RayPacket::width) {
+            RayPacket packet = computeRayPacket(x0, y0, tile._x1, tile._y1, rs);
+            _scene->intersect<Real>(packet, eye);
+            for(uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+                if(!packet.isActive(lane)) {
+                    continue;
+                }
+                vec3 color;
+                if(_recDepth > 0) {
+                    color = _scene->shade<Real>(packet.getRay(lane), _scene->getIntersection<Real>(packet, lane), 1.0, _recDepth);
+                }
+                screen.setPixel(x0 + lane % RayPacket::width, y0 + lane / RayPacket::width, color);
+            }
         }
     }
 }
 
-vec3 YourRayTracer::traceRay(const Ray& r){
-    return _scene.traceRay(r, 1.0, _recDepth);
+template<typename Real>
+void YourRayTracer::renderTilePass(Screen& screen, const Tile& tile, const RaySetup& rs, uint64_t step, bool firstPass) const {
+    // the grid starts at the tile's corner, so the blocks never reach into another tile
+    for(uint64_t y = tile._y0; y < tile._y1; y += step) {
+        for(uint64_t x = tile._x0; x < tile._x1; x += step) {
+            if(!firstPass && (x - tile._x0) % (2 * step) == 0 && (y - tile._y0) % (2 * step) == 0) {
+                continue; // on the grid of the pass before, already traced
+            }
+            vec3 color = traceRay<Real>(computeRay(x, y, rs));
+            // the traced pixel is the top left one of its block, the finer passes only overwrite the others
+            for(uint64_t by = y; by < std::min(y + step, tile._y1); ++by) {
+                for(uint64_t bx = x; bx < std::min(x + step, tile._x1); ++bx) {
+                    screen.setPixel(bx, by, color);
+                }
+            }
+            Scene::threadCounters()._primary++;
+        }
+    }
+}
+
+template<typename Real>
+vec3 YourRayTracer::traceRay(const Ray& r) const{
+    return _scene->traceRay<Real>(r, 1.0, _recDepth);
 }
 
 
-Ray YourRayTracer::computeRay(double x, double y, const RaySetup& rs){
+Ray YourRayTracer::computeRay(double x, double y, const RaySetup& rs) const{
     vec3 direction = unit_vector((rs._topLeft + rs._directionX*x + rs._directionY * y) - vec3());
     return Ray(rs._rayOrigin, direction);
-}
\ No newline at end of file
+}
+
+RayPacket YourRayTracer::computeRayPacket(uint64_t x0, uint64_t y0, uint64_t x1, uint64_t y1, const RaySetup& rs) const {
+    // computeRay with one lane per pixel. The "- vec3()" there changes nothing (x - 0 is x, also for -0), so it's
+    // left out
+    lanes<double, RayPacket::size> x, y;
+    uint32_t mask = 0;
+    for(uint32_t lane = 0; lane < RayPacket::size; ++lane) {
+        x[lane] = (double) (x0 + lane % RayPacket::width);
+        y[lane] = (double) (y0 + lane / RayPacket::width);
+        if(x0 + lane % RayPacket::width < x1 && y0 + lane / RayPacket::width < y1) {
+            mask |= 1u << lane;
+        }
+    }
+    RayPacket::Directions directions = unit_vector(RayPacket::Directions(rs._topLeft) + RayPacket::Directions(rs._directionX) * x
+                                                   + RayPacket::Directions(rs._directionY) * y);
+    RayPacket packet(rs._rayOrigin);
+    packet.setRays(directions, mask);
+    return packet;
+}
+
+// the two precisions there are, see Scene.hpp
+template void YourRayTracer::prepareScene<double>();
+template void YourRayTracer::render<double>(Screen&, const RowsCallback&);
+template void YourRayTracer::renderProgressive<double>(Screen&, const PassCallback&);
+template void YourRayTracer::renderTile<double>(Screen&, const Tile&, const RaySetup&) const;
+template void YourRayTracer::renderTilePackets<double>(Screen&, const Tile&, const RaySetup&, std::span<const EyeRelativeSphere<double>>) const;
+template void YourRayTracer::renderTilePass<double>(Screen&, const Tile&, const RaySetup&, uint64_t, bool) const;
+template vec3 YourRayTracer::traceRay<double>(const Ray&) const;
+
+template void YourRayTracer::prepareScene<float>();
+template void YourRayTracer::render<float>(Screen&, const RowsCallback&);
+template void YourRayTracer::renderProgressive<float>(Screen&, const PassCallback&);
+template void YourRayTracer::renderTile<float>(Screen&, const Tile&, const RaySetup&) const;
+template void YourRayTracer::renderTilePackets<float>(Screen&, const Tile&, const RaySetup&, std::span<const EyeRelativeSphere<float>>) const;
+template void YourRayTracer::renderTilePass<float>(Screen&, const Tile&, const RaySetup&, uint64_t, bool) const;
+template vec3 YourRayTracer::traceRay<float>(const Ray&) const;
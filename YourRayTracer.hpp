@@ -2,10 +2,13 @@
 
 #ifndef YOURRAYTRACER_HPP
 #define YOURRAYTRACER_HPP
+#include <functional>
+#include <memory>
 #include "Camera.hpp"
 #include "Ray.hpp"
 #include "Scene.hpp"
 #include "Screen.hpp"
+#include "TileScheduler.hpp"
 
 struct RaySetup{
     vec3 _topLeft;
@@ -14,19 +17,59 @@ struct RaySetup{
     vec3 _directionY;
 };
 
+// Called by renderProgressive after every finished pass with the pass number (0 is the coarsest) and the number of
+// passes. The screen then holds a complete, if blocky, preview. Returning false stops the rendering right there.
+using PassCallback = std::function<bool(const Screen& screen, unsigned pass, unsigned passCount)>;
+
+// Called by render as soon as a full row of tiles, rows [y0, y1) of the screen, is done. It runs on the worker that
+// finished the row, while the other workers go on rendering, so it's the place to start encoding those rows
+using RowsCallback = std::function<void(uint64_t y0, uint64_t y1)>;
+
 struct YourRayTracer{
     int _recDepth;
     Camera _camera;
-    Scene _scene;
+    // Shared and never changed by the renderer, so a big scene isn't copied and several renderers (or threads)
+    // can render the same one. Never null
+    std::shared_ptr<const Scene> _scene = std::make_shared<const Scene>();
     RaySetup _raySetup;
-    RaySetup computeRaySetup(Screen screen);
+    TileScheduler _scheduler;
+    bool _packetTracing = true;
+    uint64_t _coarsestStep = 16; // renderProgressive's first pass traces every 16th pixel in x and y
+    RayCounters _counters; // rays traced by the last render()
+    RaySetup computeRaySetup(const Screen& screen) const;
 
     YourRayTracer(int recDepth): _recDepth(recDepth){};
     void setCamera(Camera& camera);
-    void setScene(Scene& scene);
-    void render(Screen& screen);
-    vec3 traceRay(const Ray& r);
-    Ray computeRay(double x, double y, const RaySetup& rs);
+    void setScene(const Scene& scene); // renders a copy of scene, built right away
+    // Renders scene itself, no copy. Build it first (build<Real>() for every Real it's rendered with), or render
+    // has to make a built copy of it after all. For a scene that is owned elsewhere and outlives the renderer, a
+    // non-owning handle is std::shared_ptr<const Scene>(std::shared_ptr<const Scene>(), &scene)
+    void setScene(std::shared_ptr<const Scene> scene);
+    const Scene& getScene() const;
+    void setTileScheduler(const TileScheduler& scheduler);
+    void setPacketTracing(bool packetTracing);
+    void setProgressiveStep(uint64_t coarsestStep); // rounded down to a power of two
+    // Real is the precision of the intersection tests, see Scene::build. The screen can be a view of somebody
+    // else's memory (Screen::view), the pixels are written straight into it
+    template<typename Real = double>
+    void render(Screen& screen, const RowsCallback& onRowsDone = {});
+    template<typename Real = double>
+    void renderProgressive(Screen& screen, const PassCallback& onPass);
+    const RayCounters& getRayCounters() const;
+    template<typename Real = double>
+    void renderTile(Screen& screen, const Tile& tile, const RaySetup& rs) const;
+    template<typename Real = double>
+    void renderTilePackets(Screen& screen, const Tile& tile, const RaySetup& rs, std::span<const EyeRelativeSphere<Real>> eye) const;
+    template<typename Real = double>
+    void renderTilePass(Screen& screen, const Tile& tile, const RaySetup& rs, uint64_t step, bool firstPass) const;
+    template<typename Real = double>
+    vec3 traceRay(const Ray& r) const;
+    Ray computeRay(double x, double y, const RaySetup& rs) const;
+    // The primary rays of the RayPacket::width x RayPacket::height pixels from (x0, y0) on, all at once; the same
+    // directions as computeRay, bit for bit. Only pixels left of x1 and above y1 get a ray, the others stay inactive
+    RayPacket computeRayPacket(uint64_t x0, uint64_t y0, uint64_t x1, uint64_t y1, const RaySetup& rs) const;
+    template<typename Real = double>
+    void prepareScene(); // makes sure _scene is built for Real
 
 
 };
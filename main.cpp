@@ -3,34 +3,80 @@
 //#include <__ranges/rend.h>
 #include <ranges>
 #include<chrono>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
 
 #include "Camera.hpp"
+#include "Light.hpp"
 #include "Ray.hpp"
 #include "Scene.hpp"
 #include "Sphere.hpp"
 #include "Vector3.hpp"
 #include "Screen.hpp"
 #include "YourRayTracer.hpp"
+#include "lodepng.h"
+#include "PNGEncoder.hpp"
+#include "SceneFile.hpp"
+#include "SceneCache.hpp"
+#include "SphereKernels.hpp"
 
 
-int main() {
-    const unsigned int width = 2560;
-    const unsigned int height = 1600 ;
-    Screen screen(width, height);
+// 04_RayTrace [--progressive [seconds]] [--scene FILE] [--save-cache FILE] [--check-cache] [--kernels NAME]
+// Without --scene the scene below is rendered, otherwise the one in the file (see SceneFile.hpp and demo.scene).
+// The file can also be a scene cache (see SceneCache.hpp), which loads in next to no time. --save-cache writes the
+// scene that is about to be rendered to such a cache. --check-cache makes sure that a cache isn't damaged before it
+// is rendered, which takes reading all of it.
+// With --progressive the image is rendered coarse to fine and preview.png is rewritten after every pass (at most
+// every half second), so there's something to look at right away. With a time limit the rendering stops after the
+// first pass that ends past it, and screen.png gets whatever detail was reached by then.
+// --kernels picks the sphere kernels (scalar, sse2, sse4.2, avx2 or avx512, see SphereKernels.hpp); by default it's
+// the widest the CPU supports.
+int main(int argc, char** argv) {
+    bool progressive = false;
+    double timeLimit = 0.0;
+    const char* sceneFile = nullptr;
+    const char* cacheFile = nullptr;
+    bool checkCache = false;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--progressive") {
+            progressive = true;
+            char* end;
+            if(i + 1 < argc && (std::strtod(argv[i + 1], &end), *end == '\0')) {
+                timeLimit = std::atof(argv[++i]);
+            }
+        } else if(arg == "--scene" && i + 1 < argc) {
+            sceneFile = argv[++i];
+        } else if(arg == "--save-cache" && i + 1 < argc) {
+            cacheFile = argv[++i];
+        } else if(arg == "--check-cache") {
+            checkCache = true;
+        } else if(arg == "--kernels" && i + 1 < argc && selectKernels(argv[i + 1])) {
+            ++i;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--progressive [seconds]] [--scene FILE] [--save-cache FILE] [--check-cache] [--kernels NAME]" << std::endl;
+            return 2;
+        }
+    }
+
+    uint64_t width = 2560;
+    uint64_t height = 1600 ;
     Camera camera;
     camera.setEyePoint(vec3(0.0,1.0,-5.0));
     camera.setLookAt(vec3(0.0,0.0,0.0));
 
     Scene scene(vec3(0.0,0.0,0.0));
 
-    Material black = Material(vec3(0.1, 0.1, 0.1), vec3(0.3, 0.3, 0.3), vec3(1, 1, 1), 8, 0.3);
-    Material glass = Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.2, 1.52);
-    Material mirror = Material(vec3(1.0, 1.0, 1.0), vec3(1,1,1), vec3(1, 1, 1), 8, 0.1);
-    Material red = Material(vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 1, 1), 8, 0.8);
-    Material cyan = Material(vec3(0, 1, 1), vec3(0, 1, 1), vec3(1, 1, 1), 8, 0.8);
-    Material yellow = Material(vec3(1, 1, 0), vec3(1, 1, 0), vec3(1, 1, 1), 8, 0.8);
-    Material green = Material(vec3(0, 1, 0), vec3(0, 1, 0), vec3(1, 1, 1), 8, 0.8);
-    Material white = Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.8);
+    MaterialIndex black = scene.addMaterial(Material(vec3(0.1, 0.1, 0.1), vec3(0.3, 0.3, 0.3), vec3(1, 1, 1), 8, 0.3));
+    MaterialIndex glass = scene.addMaterial(Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.2, 1.52));
+    MaterialIndex mirror = scene.addMaterial(Material(vec3(1.0, 1.0, 1.0), vec3(1,1,1), vec3(1, 1, 1), 8, 0.1));
+    MaterialIndex red = scene.addMaterial(Material(vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 1, 1), 8, 0.8));
+    MaterialIndex cyan = scene.addMaterial(Material(vec3(0, 1, 1), vec3(0, 1, 1), vec3(1, 1, 1), 8, 0.8));
+    MaterialIndex yellow = scene.addMaterial(Material(vec3(1, 1, 0), vec3(1, 1, 0), vec3(1, 1, 1), 8, 0.8));
+    MaterialIndex green = scene.addMaterial(Material(vec3(0, 1, 0), vec3(0, 1, 0), vec3(1, 1, 1), 8, 0.8));
+    MaterialIndex white = scene.addMaterial(Material(vec3(0.3, 0.3, 0.3), vec3(0.5, 0.5, 0.5), vec3(1, 1, 1), 8, 0.8));
 
     Sphere s1 = Sphere(0.5, vec3{2,-1,2.5},  white); //unlike praktikum 03: HitSpheres, now our spheres have user defined colors, our spheres now can have shades, reflective and refractive properties
     Sphere s2 = Sphere(1.0, vec3{-5, -1, 6.2},  red);
@@ -46,20 +92,91 @@ int main() {
     for(auto sphere: spheres) {
         scene.addSphere(sphere);
     }
-    YourRayTracer renderer(9); // same rendering like the last project, additionally we only try to find the runtime for the actual rendering process using chrono library
+
+    // white light shining straight down from far above. The spheres now cast shadows on each other
+    scene.addLight(Light::Directional(vec3(0.0,-1.0,0.0), vec3(1.0,1.0,1.0)));
+    int recDepth = 9;
+
+    if(sceneFile) {
+        // loading is timed on its own, for big scenes it can take as long as the rendering
+        auto loadStart = std::chrono::system_clock::now();
+        std::string loadError;
+        std::optional<SceneDescription> description = isSceneCache(sceneFile) ? loadSceneCache(sceneFile, loadError, checkCache)
+                                                                               : loadSceneFile(sceneFile, loadError);
+        if(!description) {
+            std::cerr << loadError << std::endl;
+            return 1;
+        }
+        std::chrono::duration<double> loadSeconds = std::chrono::system_clock::now() - loadStart;
+        std::cout << "scene load time: " << loadSeconds.count() << "s (" << description->_scene.sphereCount()
+                  << " spheres)" << std::endl;
+        scene = std::move(description->_scene);
+        camera = description->_camera;
+        recDepth = description->_recDepth;
+        if(description->_width > 0 && description->_height > 0) {
+            width = description->_width;
+            height = description->_height;
+        }
+    }
+
+    scene.build();
+    if(cacheFile) {
+        std::string cacheError;
+        if(!saveSceneCache(SceneDescription{scene, camera, recDepth, width, height}, cacheFile, cacheError)) {
+            std::cerr << cacheError << std::endl;
+            return 1;
+        }
+    }
+
+    Screen screen(width, height);
+    YourRayTracer renderer(recDepth); // same rendering like the last project, additionally we only try to find the runtime for the actual rendering process using chrono library
     renderer.setCamera(camera);
-    renderer.setScene(scene);
+    renderer.setScene(std::make_shared<const Scene>(std::move(scene))); // built above, so the renderer takes it as it is
     auto start = std::chrono::system_clock::now();
     // Some computation here
-    renderer.render(screen);
+    std::vector<unsigned char> png;
+    unsigned error = 0;
+    if(progressive) {
+        auto lastPreview = start;
+        renderer.renderProgressive(screen, [&](const Screen& preview, unsigned pass, unsigned passCount) {
+            auto now = std::chrono::system_clock::now();
+            std::chrono::duration<double> elapsed = now - start;
+            bool last = pass + 1 == passCount || (timeLimit > 0 && elapsed.count() >= timeLimit);
+            if(!last && (pass == 0 || now - lastPreview >= std::chrono::milliseconds(500))) {
+                std::vector<unsigned char> previewFile;
+                PNGEncodeStats stats = preview.encodePNG(previewFile, PNGProfile::Fast); // a preview has to be quick, not small
+                if(!stats._error && !lodepng::save_file(previewFile, "preview.png")) {
+                    std::cout << "preview " << pass + 1 << "/" << passCount << " after " << elapsed.count() << "s ("
+                              << stats._bytes << " bytes encoded in " << stats._seconds << "s)" << std::endl;
+                }
+                lastPreview = std::chrono::system_clock::now();
+            }
+            return !last;
+        });
+    } else {
+        // the PNG is encoded strip by strip while the rest of the image is still being rendered
+        PNGEncoder encoder(width, height, renderer._scheduler.getTileHeight());
+        renderer.render(screen, [&](uint64_t y0, uint64_t y1) {
+            encoder.encodeRows(screen, y0, y1);
+        });
+        error = encoder.finish(png);
+    }
     auto end = std::chrono::system_clock::now();
 
     std::chrono::duration<double> elapsed_seconds = end-start;
     std::time_t end_time = std::chrono::system_clock::to_time_t(end);
 
-    std::cout << "elapsed time: " << elapsed_seconds.count() << "s"
+    std::cout << "elapsed time: " << elapsed_seconds.count() << "s (" << activeKernels()._name << " sphere kernels)"
               << std::endl;
 
-    screen.saveAsPNG("screen.png");
+    if(progressive) {
+        screen.saveAsPNG("screen.png");
+    } else {
+        // rendered and encoded (the time above includes the encoding), only the writing is left
+        if(!error) {
+            error = lodepng::save_file(png, "screen.png");
+        }
+        std::cout << error << std::endl;
+    }
     return 0;
 }